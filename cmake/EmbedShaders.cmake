@@ -0,0 +1,82 @@
+# Preprocesses the GLSL shaders and writes them into a header as string constants, so the app never reads
+# a shader file and doesn't care about its working directory.
+# Run in script mode: cmake -DGLSL_DIR=<src/sina/GLSL> -DOUTPUT=<header> -P EmbedShaders.cmake
+#
+# Every variant below becomes one constant: NAME|FILE|DEFINES, DEFINES separated by spaces. The defines go
+# right after the #version line, so the variant is ready to compile as is, nothing is pieced together at
+# runtime. #include "file" is replaced by the file (looked up in GLSL_DIR), before the defines are added.
+cmake_policy(SET CMP0007 NEW) # Keep the empty DEFINES field of a variant
+
+set(SHADER_VARIANTS
+  "GLSL_TEXT_VERTEX|vertex.glsl|"
+  "GLSL_TEXT_FRAGMENT|fragment.glsl|"
+  "GLSL_TEXT_FRAGMENT_SDF|fragment.glsl|SDF_TEXT"
+  "GLSL_OBJECT_VERTEX|vertex_object.glsl|"
+  "GLSL_OBJECT_FRAGMENT|fragment_object.glsl|")
+
+# Deep enough for any sane include chain, stops include cycles
+set(MAX_INCLUDES 64)
+
+if(NOT GLSL_DIR OR NOT OUTPUT)
+  message(FATAL_ERROR "Usage: cmake -DGLSL_DIR=<dir> -DOUTPUT=<header> -P EmbedShaders.cmake")
+endif()
+
+function(read_shader FILE RESULT)
+  if(NOT EXISTS ${GLSL_DIR}/${FILE})
+    message(FATAL_ERROR "Shader not found: ${GLSL_DIR}/${FILE}")
+  endif()
+  file(READ ${GLSL_DIR}/${FILE} SOURCE)
+  set(INCLUDES 0)
+  string(REGEX MATCH "#include[ \t]*\"[^\"]*\"" DIRECTIVE "${SOURCE}")
+  while(DIRECTIVE)
+    math(EXPR INCLUDES "${INCLUDES} + 1")
+    if(INCLUDES GREATER MAX_INCLUDES)
+      message(FATAL_ERROR "${FILE}: more than ${MAX_INCLUDES} includes, is there a cycle?")
+    endif()
+    string(REGEX REPLACE "#include[ \t]*\"([^\"]*)\"" "\\1" INCLUDED "${DIRECTIVE}")
+    if(NOT EXISTS ${GLSL_DIR}/${INCLUDED})
+      message(FATAL_ERROR "${FILE}: included ${INCLUDED} not found in ${GLSL_DIR}")
+    endif()
+    file(READ ${GLSL_DIR}/${INCLUDED} INCLUDED_SOURCE)
+    string(REPLACE "${DIRECTIVE}" "${INCLUDED_SOURCE}" SOURCE "${SOURCE}")
+    string(REGEX MATCH "#include[ \t]*\"[^\"]*\"" DIRECTIVE "${SOURCE}")
+  endwhile()
+  set(${RESULT} "${SOURCE}" PARENT_SCOPE)
+endfunction()
+
+set(HEADER "// Generated from src/sina/GLSL by cmake/EmbedShaders.cmake, edit the shaders instead\n")
+set(HEADER "${HEADER}#ifndef EMBEDDED_SHADERS_H\n#define EMBEDDED_SHADERS_H\n")
+foreach(VARIANT ${SHADER_VARIANTS})
+  string(REPLACE "|" ";" FIELDS "${VARIANT}")
+  list(GET FIELDS 0 NAME)
+  list(GET FIELDS 1 FILE)
+  list(LENGTH FIELDS FIELD_COUNT)
+  set(DEFINES "")
+  if(FIELD_COUNT GREATER 2)
+    list(GET FIELDS 2 DEFINES)
+  endif()
+
+  read_shader(${FILE} SOURCE)
+  if(NOT SOURCE MATCHES "#version[^\n]*\n")
+    message(FATAL_ERROR "${FILE}: no #version line")
+  endif()
+  string(STRIP "// ${FILE} ${DEFINES}" COMMENT)
+  set(DEFINE_LINES "")
+  if(DEFINES)
+    string(REPLACE " " ";" DEFINES "${DEFINES}")
+    foreach(DEFINE ${DEFINES})
+      set(DEFINE_LINES "${DEFINE_LINES}#define ${DEFINE} 1\n")
+    endforeach()
+  endif()
+  string(REGEX REPLACE "(#version[^\n]*\n)" "\\1${DEFINE_LINES}" SOURCE "${SOURCE}")
+  if(SOURCE MATCHES "\\)glsl\"")
+    message(FATAL_ERROR "${FILE}: contains the raw string delimiter )glsl\"")
+  endif()
+  set(HEADER "${HEADER}\n${COMMENT}\nconst char *const ${NAME} = R\"glsl(${SOURCE})glsl\";\n")
+endforeach()
+set(HEADER "${HEADER}\n#endif\n")
+
+# Only touched when something changed, so the app isn't rebuilt for nothing
+file(WRITE ${OUTPUT}.tmp "${HEADER}")
+execute_process(COMMAND ${CMAKE_COMMAND} -E copy_if_different ${OUTPUT}.tmp ${OUTPUT})
+file(REMOVE ${OUTPUT}.tmp)
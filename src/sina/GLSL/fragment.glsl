@@ -1,13 +1,23 @@
 //FRAGMENT SHADER
-#version 330 core
+// With SDF_TEXT defined the glyphs are signed distance fields, otherwise coverage bitmaps
+#include "version.glsl"
 in vec2 TexCoords;
+in vec4 TextColor;
 out vec4 color;
 
 uniform sampler2D text;
-uniform vec3 textColor;
 
 void main()
 {
+#ifdef SDF_TEXT
+    // 0.5 is the glyph edge. The ramp is about one screen pixel wide whatever the scale,
+    // so edges stay sharp when magnified and don't alias when minified.
+    float distance = texture(text, TexCoords).r;
+    float smoothing = 0.7 * fwidth(distance);
+    float alpha = smoothstep(0.5 - smoothing, 0.5 + smoothing, distance);
+    color = vec4(TextColor.rgb, TextColor.a * alpha);
+#else
     vec4 sampled = vec4(1.0, 1.0, 1.0, texture(text, TexCoords).r);
-    color = vec4(textColor, 1.0) * sampled;
-} 
\ No newline at end of file
+    color = TextColor * sampled;
+#endif
+} 
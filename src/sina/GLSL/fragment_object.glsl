@@ -1,12 +1,13 @@
 //FRAGMENT SHADER
-#version 330 core
+#include "version.glsl"
 out vec4 FragColor;
 
 in vec3 ourColor;
 in vec2 TexCoord;
+in vec2 SpriteCoord;
 
 uniform sampler2D texture1;
-uniform sampler2D texture2;
+uniform sampler2D texture2; // Sprite atlas page
 
 void main()
 {
@@ -15,5 +16,5 @@ void main()
     // For adding a single texture.
     //FragColor = texture(texture1, TexCoord);// * vec4(ourColor, 1.0); 
     // For adding multiple textures
-    FragColor = mix(texture(texture1, TexCoord), texture(texture2, TexCoord), 0.2f);
+    FragColor = mix(texture(texture1, TexCoord), texture(texture2, SpriteCoord), 0.2f);
 } 
\ No newline at end of file
@@ -0,0 +1,8 @@
+// Per frame values shared by every program, written once a frame (see FrameGlobals.hpp, which has to
+// match this std140 layout)
+layout (std140) uniform FrameGlobals
+{
+    mat4 projection; // Orthographic, in window coordinates
+    vec4 viewport;   // Framebuffer width, height, 1 / width, 1 / height in pixels
+    vec4 time;       // Seconds since start, seconds since the last frame, unused, unused
+};
@@ -0,0 +1,2 @@
+// Included first by every shader, the one place the GLSL version is set
+#version 330 core
@@ -1,12 +1,19 @@
 //VERTEX SHADER
-#version 330 core
-layout (location = 0) in vec4 vertex; // <vec2 pos, vec2 tex>
+#include "version.glsl"
+layout (location = 0) in vec2 corner;     // unit quad corner, (0, 0) is bottom left
+layout (location = 1) in vec2 glyphPos;   // per glyph: bottom left corner in pixels
+layout (location = 2) in vec2 glyphSize;  // per glyph: quad size in pixels
+layout (location = 3) in vec4 glyphRect;  // per glyph: atlas rectangle <u0, v0, u1, v1>, v0 at the top
+layout (location = 4) in uint glyphColor; // per glyph: index into textPalette
 out vec2 TexCoords;
+out vec4 TextColor;
 
-uniform mat4 projection;
+#include "frame_globals.glsl"
+uniform vec4 textPalette[16];
 
 void main()
 {
-    gl_Position = projection * vec4(vertex.xy, 0.0, 1.0);
-    TexCoords = vertex.zw;
+    gl_Position = projection * vec4(glyphPos + corner * glyphSize, 0.0, 1.0);
+    TexCoords = vec2(mix(glyphRect.x, glyphRect.z, corner.x), mix(glyphRect.w, glyphRect.y, corner.y));
+    TextColor = textPalette[glyphColor];
 }
\ No newline at end of file
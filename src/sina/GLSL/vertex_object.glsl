@@ -1,15 +1,19 @@
 //VERTEX SHADER
-#version 330 core
+#include "version.glsl"
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aColor;
 layout (location = 2) in vec2 aTexCoord;
 
 out vec3 ourColor;
 out vec2 TexCoord;
+out vec2 SpriteCoord;
+
+uniform vec4 spriteRect; // Where the sprite is in its atlas page: u, v, width, height
 
 void main()
 {
     gl_Position = vec4(aPos, 1.0);
     ourColor = aColor;
     TexCoord = aTexCoord;
+    SpriteCoord = spriteRect.xy + aTexCoord * spriteRect.zw;
 }
\ No newline at end of file
@@ -0,0 +1,372 @@
+#ifndef ASYNC_TEXTURE_LOADER_H
+#define ASYNC_TEXTURE_LOADER_H
+
+#include <glad/glad.h>
+#include <stb_image.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "MipGenerator.hpp"
+#include "PixelBufferRing.hpp"
+#include "PixelConverter.hpp"
+#include "PngStreamDecoder.hpp"
+
+// Loads textures without blocking the render loop. Image files are decoded by worker threads;
+// the GL thread only uploads finished images, as many as fit in a time budget every frame.
+// A requested texture name is usable right away: it holds a grey placeholder until its image arrives.
+//
+// Uploads stream through a ring of pixel unpack buffers: the GL thread maps a free buffer, a worker
+// copies the decoded image into it, and glTexImage2D then reads the buffer asynchronously instead of
+// copying client memory before it returns. A texture takes two frames from decoded to visible.
+// The workers also convert the images to RGBA (see PixelConverter.hpp) and build their mip chains
+// (sRGB correct), which are streamed with the image.
+//
+// PNGs skip the decoded copy: a worker only reads their header, and once the GL thread has mapped an
+// upload buffer of their size, libpng decodes them (and the mips are built) row by row straight into
+// it. Loading a big PNG then takes little more client memory than a few rows.
+class AsyncTextureLoader
+{
+public:
+    // Called by update() once a texture is uploaded (bytes streamed to it) or failed to load (0 bytes)
+    typedef void (*DoneCallback)(void *user, GLuint texture, size_t bytes);
+
+    AsyncTextureLoader()
+        : mipGenerator(1), flipVertically(false), stopping(false), inFlight(0), doneCallback(NULL), doneUser(NULL)
+    {
+    }
+
+    // Call stbi_set_flip_vertically_on_load before this, stb_image's settings are shared by every thread.
+    // flipVertically is what it was set to, PNGs are decoded by libpng and have to match.
+    void start(unsigned threadCount, size_t uploadBuffers, bool flipVertically)
+    {
+        this->flipVertically = flipVertically;
+        stopping = false;
+        ring.init(std::max<size_t>(1, uploadBuffers));
+        for (unsigned t = 0; t < std::max(1u, threadCount); t++)
+            workers.push_back(std::thread(&AsyncTextureLoader::decodeLoop, this));
+    }
+
+    // Stops the workers. Images that were not uploaded yet are dropped.
+    void destroy()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (size_t t = 0; t < workers.size(); t++)
+            workers[t].join();
+        workers.clear();
+        requests.clear();
+        decoded.clear();
+        copies.clear();
+        staged.clear();
+        ring.destroy(); // Also unmaps buffers that were still waiting for their copy
+        inFlight = 0;
+    }
+
+    // Puts the placeholder into `texture` and queues the file for decoding. Whatever its channels, the
+    // image is converted to RGBA with `conversion` (PixelConversion flags) and uploaded into internal_format.
+    void load(GLuint texture, const std::string &imagePath,
+              int wrap_s, int wrap_t, int min_filter, int mag_filter,
+              int internal_format, unsigned conversion)
+    {
+        // The placeholder has a single level, so it must not sample with mipmaps
+        const GLubyte grey[4] = { 128, 128, 128, 255 };
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        Job job;
+        job.texture = texture;
+        job.path = imagePath;
+        job.wrapS = wrap_s;
+        job.wrapT = wrap_t;
+        job.minFilter = min_filter;
+        job.magFilter = mag_filter;
+        job.internalFormat = internal_format;
+        job.conversion = conversion;
+        job.width = job.height = 0;
+        job.slot = -1;
+        job.staging = NULL;
+        job.failed = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            requests.push_back(std::move(job));
+        }
+        inFlight++;
+        wake.notify_one();
+    }
+
+    // Uploads staged images and hands upload buffers to decoded ones until budgetMs is used up,
+    // doing at least one step per call so loading always progresses. Call once per frame from the GL thread.
+    // Returns how many textures were finished.
+    size_t update(double budgetMs)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        size_t finished = 0;
+        for (;;)
+        {
+            Job job;
+            bool upload;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                upload = !staged.empty();
+                if (!upload && decoded.empty())
+                    break;
+                std::deque<Job> &queue = upload ? staged : decoded;
+                job = std::move(queue.front());
+                queue.pop_front();
+            }
+            if (upload)
+            {
+                size_t bytes = uploadStaged(job);
+                if (bytes == 0)
+                    std::cout << "Failed to load texture " << job.path << std::endl;
+                inFlight--;
+                finished++;
+                if (doneCallback)
+                    doneCallback(doneUser, job.texture, bytes);
+            }
+            else if (job.pixels.empty() && !job.png)
+            {
+                // The placeholder stays
+                std::cout << "Failed to load texture " << job.path << std::endl;
+                inFlight--;
+                if (doneCallback)
+                    doneCallback(doneUser, job.texture, 0);
+            }
+            else
+            {
+                job.slot = ring.acquire(uploadBytes(job), job.staging);
+                if (job.slot == PIXEL_BUFFER_MAP_FAILED)
+                {
+                    // The placeholder stays
+                    std::cout << "Failed to map an upload buffer for texture " << job.path << std::endl;
+                    inFlight--;
+                    if (doneCallback)
+                        doneCallback(doneUser, job.texture, 0);
+                }
+                else
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (job.slot == PIXEL_BUFFER_BUSY)
+                    {
+                        // Every buffer is still in flight: try again next frame
+                        decoded.push_front(std::move(job));
+                        break;
+                    }
+                    copies.push_back(std::move(job));
+                    wake.notify_one();
+                }
+            }
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+            if (elapsed.count() >= budgetMs)
+                break;
+        }
+        ring.endFrame();
+        return finished;
+    }
+
+    // Textures requested but not uploaded yet
+    size_t pending() const { return inFlight; }
+
+    void setDoneCallback(DoneCallback callback, void *user)
+    {
+        doneCallback = callback;
+        doneUser = user;
+    }
+
+    // Upload bandwidth: bytes streamed by the last update, the most in one update and in total
+    size_t lastFrameUploadBytes() const { return ring.lastFrameUploadBytes(); }
+    size_t peakFrameUploadBytes() const { return ring.peakFrameUploadBytes(); }
+    size_t totalUploadBytes() const { return ring.totalUploadBytes(); }
+
+private:
+    struct Job
+    {
+        GLuint texture;
+        std::string path;
+        int wrapS, wrapT;
+        int minFilter, magFilter;
+        int internalFormat;
+        unsigned conversion;
+        std::vector<GLubyte> pixels; // RGBA, empty if decoding failed or the image is streamed
+        std::unique_ptr<PngStreamDecoder> png; // Streams the image into the upload buffer, only its header is read yet
+        int width, height;
+        std::vector<MipLevel> mips; // Levels 1 and down, their pixels are freed once copied
+        int slot;     // Upload buffer holding the pixels, then the mips one after the other
+        void *staging; // Its mapped memory
+        bool failed;   // The streamed image turned out broken, the buffer holds garbage
+    };
+
+    static size_t imageBytes(const Job &job)
+    {
+        return static_cast<size_t>(job.width) * job.height * 4;
+    }
+
+    static size_t uploadBytes(const Job &job)
+    {
+        size_t bytes = imageBytes(job);
+        for (size_t i = 0; i < job.mips.size(); i++)
+            bytes += static_cast<size_t>(job.mips[i].width) * job.mips[i].height * 4;
+        return bytes;
+    }
+
+    void decodeLoop()
+    {
+        for (;;)
+        {
+            Job job;
+            bool copy;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                while (!stopping && requests.empty() && copies.empty())
+                    wake.wait(lock);
+                if (stopping)
+                    return;
+                // Copies first: a texture waits on each of them, with its upload buffer mapped
+                copy = !copies.empty();
+                std::deque<Job> &queue = copy ? copies : requests;
+                job = std::move(queue.front());
+                queue.pop_front();
+            }
+            // The slow parts, done without holding the lock
+            if (copy && job.png)
+            {
+                GLubyte *staging = static_cast<GLubyte*>(job.staging);
+                job.failed = !job.png->decode(staging, staging + imageBytes(job), srgbMips(job), job.conversion);
+                job.png.reset();
+            }
+            else if (copy)
+            {
+                GLubyte *staging = static_cast<GLubyte*>(job.staging);
+                std::memcpy(staging, &job.pixels[0], imageBytes(job));
+                staging += imageBytes(job);
+                for (size_t i = 0; i < job.mips.size(); i++)
+                {
+                    std::memcpy(staging, &job.mips[i].pixels[0], job.mips[i].pixels.size());
+                    staging += job.mips[i].pixels.size();
+                    std::vector<GLubyte>().swap(job.mips[i].pixels);
+                }
+                std::vector<GLubyte>().swap(job.pixels);
+            }
+            else if (isPng(job.path) && openPng(job))
+            {
+                // Decoded when it has its upload buffer, only the sizes are needed to get one
+                for (GLuint w = job.width, h = job.height; w > 1 || h > 1;)
+                {
+                    job.mips.push_back(MipLevel());
+                    job.mips.back().width = w = std::max(1u, w / 2);
+                    job.mips.back().height = h = std::max(1u, h / 2);
+                }
+            }
+            else
+            {
+                int channels;
+                unsigned char *image = stbi_load(job.path.c_str(), &job.width, &job.height, &channels, 0);
+                if (image)
+                {
+                    size_t count = static_cast<size_t>(job.width) * job.height;
+                    job.pixels.resize(count * 4);
+                    convertPixels(mipGenerator.simdLevel(), image, channels, &job.pixels[0], count, job.conversion);
+                    stbi_image_free(image);
+                    mipGenerator.generate(&job.pixels[0], job.width, job.height, 4, srgbMips(job), MIP_FILTER_BOX,
+                                          job.mips);
+                }
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping)
+                return;
+            (copy ? staged : decoded).push_back(std::move(job));
+        }
+    }
+
+    static bool isPng(const std::string &path)
+    {
+        return path.size() >= 4 && (path.compare(path.size() - 4, 4, ".png") == 0 ||
+                                    path.compare(path.size() - 4, 4, ".PNG") == 0);
+    }
+
+    // Reads the header of a PNG to stream later. Interlaced ones are left to stb_image.
+    bool openPng(Job &job)
+    {
+        job.png.reset(new PngStreamDecoder());
+        if (!job.png->open(job.path, flipVertically))
+        {
+            job.png.reset();
+            return false;
+        }
+        job.width = job.png->imageWidth();
+        job.height = job.png->imageHeight();
+        return true;
+    }
+
+    // Colors decoded to linear are averaged as they are, the others as sRGB
+    static bool srgbMips(const Job &job)
+    {
+        return !(job.conversion & PIXEL_CONVERT_LINEAR);
+    }
+
+    // The pixels are in the job's upload buffer, glTexImage2D gets offsets into it.
+    // Returns the bytes uploaded, 0 when the image was broken or the buffer lost and the placeholder stays.
+    size_t uploadStaged(const Job &job)
+    {
+        bool intact = ring.bind(job.slot);
+        if (job.failed || !intact)
+        {
+            ring.release(job.slot, 0);
+            return 0;
+        }
+        glBindTexture(GL_TEXTURE_2D, job.texture);
+        // Wrapping options. Either GL_REPEAT, GL_MIRRORED_REPEAT, GL_CLAMP_TO_EDGE, or GL_CLAMP_TO_BORDER.
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, job.wrapS);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, job.wrapT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, job.minFilter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, job.magFilter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(job.mips.size()));
+        GLenum format = pixelUploadFormat(job.conversion);
+        glTexImage2D(GL_TEXTURE_2D, 0, job.internalFormat, job.width, job.height, 0,
+                     format, GL_UNSIGNED_BYTE, (void*)0);
+        size_t offset = imageBytes(job);
+        for (size_t i = 0; i < job.mips.size(); i++)
+        {
+            const MipLevel &mip = job.mips[i];
+            glTexImage2D(GL_TEXTURE_2D, static_cast<GLint>(i + 1), job.internalFormat, mip.width, mip.height, 0,
+                         format, GL_UNSIGNED_BYTE, (void*)offset);
+            offset += static_cast<size_t>(mip.width) * mip.height * 4;
+        }
+        ring.release(job.slot, offset);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return offset;
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<Job> requests; // Waiting for a worker to decode them
+    std::deque<Job> decoded;  // Waiting for the GL thread to map an upload buffer
+    std::deque<Job> copies;   // Waiting for a worker to copy them into the buffer
+    std::deque<Job> staged;   // Waiting for the GL thread to upload them
+    PixelBufferRing ring;
+    MipGenerator mipGenerator; // One thread, the workers already decode side by side
+    bool flipVertically;
+    bool stopping;
+    size_t inFlight;
+    DoneCallback doneCallback;
+    void *doneUser;
+};
+
+#endif
@@ -0,0 +1,187 @@
+#ifndef ATLAS_CACHE_H
+#define ATLAS_CACHE_H
+
+#include <glad/glad.h>
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "GlyphTable.hpp"
+
+// Bump whenever the layout of the file or the way glyphs are rasterized changes
+const uint32_t ATLAS_CACHE_VERSION = 2;
+
+// Everything the baked atlas depends on. A cache file is only used when all of it matches.
+struct AtlasCacheKey
+{
+    uint64_t fontHash;     // FNV-1a of the whole font file
+    uint32_t pixelSize;
+    uint32_t sdfSpread;    // 0 for bitmap glyphs
+    uint32_t atlasWidth;
+    uint32_t glyphSetHash; // FNV-1a of the codepoint list
+};
+
+// On-disk layout: this header, glyphCount Character records, then atlasWidth x atlasHeight pixels.
+struct AtlasCacheHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t characterSize; // sizeof(Character), catches layout changes that forgot the version
+    uint32_t glyphCount;
+    uint32_t atlasHeight;
+    uint32_t reserved;
+    AtlasCacheKey key;
+};
+
+inline uint64_t fnv1a64(const void *data, size_t size, uint64_t hash = 14695981039346656037ULL)
+{
+    const GLubyte *bytes = static_cast<const GLubyte*>(data);
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    return hash;
+}
+
+// Builds the key of a font/size/glyph set. Fails when the font file can't be read.
+inline bool makeAtlasCacheKey(const char *fontPath, GLuint pixelSize, GLint sdfSpread, GLint atlasWidth,
+                              const std::vector<GLuint> &codepoints, AtlasCacheKey &key)
+{
+    int fd = open(fontPath, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat info;
+    void *font = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && info.st_size > 0)
+        font = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (font == MAP_FAILED)
+        return false;
+
+    std::memset(&key, 0, sizeof(key)); // No uninitialized padding in the file
+    key.fontHash = fnv1a64(font, info.st_size);
+    munmap(font, info.st_size);
+    key.pixelSize = pixelSize;
+    key.sdfSpread = sdfSpread;
+    key.atlasWidth = atlasWidth;
+    key.glyphSetHash = static_cast<uint32_t>(fnv1a64(codepoints.empty() ? NULL : &codepoints[0],
+                                                     codepoints.size() * sizeof(GLuint)));
+    return true;
+}
+
+// A baked atlas mapped straight from disk. The pixels are handed to glTexSubImage2D without a copy.
+class MappedAtlasCache
+{
+public:
+    MappedAtlasCache()
+        : data(NULL), size(0)
+    {
+    }
+
+    ~MappedAtlasCache()
+    {
+        unmap();
+    }
+
+    // Maps the file and checks it was baked for this key. Fails on any mismatch or truncation.
+    bool open(const char *path, const AtlasCacheKey &key)
+    {
+        unmap();
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat info;
+        if (fstat(fd, &info) == 0 && static_cast<size_t>(info.st_size) >= sizeof(AtlasCacheHeader))
+        {
+            void *mapped = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED)
+            {
+                data = static_cast<const GLubyte*>(mapped);
+                size = info.st_size;
+            }
+        }
+        ::close(fd);
+        if (!data)
+            return false;
+
+        const AtlasCacheHeader &h = header();
+        bool valid = std::memcmp(h.magic, "GLAC", 4) == 0 && h.version == ATLAS_CACHE_VERSION &&
+                     h.characterSize == sizeof(Character) && std::memcmp(&h.key, &key, sizeof(key)) == 0 &&
+                     size == sizeof(AtlasCacheHeader) + h.glyphCount * sizeof(Character) +
+                             static_cast<size_t>(h.key.atlasWidth) * h.atlasHeight;
+        if (!valid)
+            unmap();
+        return valid;
+    }
+
+    GLuint glyphCount() const { return header().glyphCount; }
+    GLint atlasHeight() const { return header().atlasHeight; }
+
+    // The records may not be aligned in the mapping, so they are copied out
+    Character character(GLuint i) const
+    {
+        Character ch;
+        std::memcpy(&ch, data + sizeof(AtlasCacheHeader) + i * sizeof(Character), sizeof(Character));
+        return ch;
+    }
+
+    const GLubyte *pixels() const
+    {
+        return data + sizeof(AtlasCacheHeader) + header().glyphCount * sizeof(Character);
+    }
+
+private:
+    const AtlasCacheHeader &header() const
+    {
+        return *reinterpret_cast<const AtlasCacheHeader*>(data);
+    }
+
+    void unmap()
+    {
+        if (data)
+            munmap(const_cast<GLubyte*>(data), size);
+        data = NULL;
+        size = 0;
+    }
+
+    const GLubyte *data;
+    size_t size;
+};
+
+// Writes a baked atlas. Goes through a temporary file so a crash never leaves a truncated cache behind.
+inline bool writeAtlasCache(const char *path, const AtlasCacheKey &key, const std::vector<Character> &characters,
+                            const GLubyte *pixels, GLint atlasHeight)
+{
+    AtlasCacheHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "GLAC", 4);
+    header.version = ATLAS_CACHE_VERSION;
+    header.characterSize = sizeof(Character);
+    header.glyphCount = static_cast<uint32_t>(characters.size());
+    header.atlasHeight = atlasHeight;
+    header.key = key;
+
+    std::string temporary = std::string(path) + ".tmp";
+    FILE *file = std::fopen(temporary.c_str(), "wb");
+    if (!file)
+        return false;
+    size_t pixelBytes = static_cast<size_t>(key.atlasWidth) * atlasHeight;
+    bool written = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   (characters.empty() ||
+                    std::fwrite(&characters[0], sizeof(Character), characters.size(), file) == characters.size()) &&
+                   (pixelBytes == 0 || std::fwrite(pixels, 1, pixelBytes, file) == pixelBytes);
+    written = std::fclose(file) == 0 && written;
+    if (!written || std::rename(temporary.c_str(), path) != 0)
+    {
+        std::remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+#endif
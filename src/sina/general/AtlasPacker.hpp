@@ -0,0 +1,62 @@
+#ifndef ATLAS_PACKER_H
+#define ATLAS_PACKER_H
+
+// Shelf (row) packer used to place many small rectangles inside a single texture.
+// Rectangles go left to right along the current shelf. When the next one doesn't fit,
+// a new shelf is opened right below, as tall as the tallest rectangle of the last shelf.
+class AtlasPacker
+{
+public:
+    AtlasPacker(int width, int height, int padding = 1)
+        : width(width), height(height), padding(padding)
+    {
+        reset();
+    }
+
+    // Finds room for a w x h rectangle. Returns false when the atlas is full.
+    bool pack(int w, int h, int &x, int &y)
+    {
+        if (w + 2 * padding > width)
+            return false;
+        if (cursorX + w + padding > width)
+        {
+            // Start a new shelf under the current one
+            shelfY += shelfHeight + padding;
+            cursorX = padding;
+            shelfHeight = 0;
+        }
+        if (shelfY + h + padding > height)
+            return false;
+
+        x = cursorX;
+        y = shelfY;
+        cursorX += w + padding;
+        if (h > shelfHeight)
+            shelfHeight = h;
+        return true;
+    }
+
+    // Height actually touched so far, useful to trim the texture to what was used.
+    int usedHeight() const
+    {
+        return shelfY + shelfHeight + padding;
+    }
+
+    void reset()
+    {
+        cursorX = padding;
+        shelfY = padding;
+        shelfHeight = 0;
+    }
+
+    int width;
+    int height;
+    int padding;
+
+private:
+    int cursorX;
+    int shelfY;
+    int shelfHeight;
+};
+
+#endif
@@ -0,0 +1,372 @@
+#ifndef BLOCK_COMPRESSOR_H
+#define BLOCK_COMPRESSOR_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+#include "MipGenerator.hpp"
+
+// S3TC is an extension even in GL 3.3 core, the bundled loader doesn't define its formats
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+// Block compressed formats: every 4x4 texels take a fixed number of bytes, and the GPU samples them as is
+enum BlockFormat
+{
+    BLOCK_FORMAT_BC1, // RGB, 8 bytes per block: two 565 colors and a 2 bit index per texel
+    BLOCK_FORMAT_BC3, // RGBA, 16 bytes per block: a BC4 block of alpha, then a BC1 block of color
+    BLOCK_FORMAT_BC4  // One channel, 8 bytes per block: two 8 bit values and a 3 bit index per texel
+};
+
+// Block rows per thread below which more threads cost more than they save
+const GLuint BLOCK_ROWS_PER_THREAD = 4;
+
+inline GLenum blockFormatGL(BlockFormat format)
+{
+    return format == BLOCK_FORMAT_BC1 ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+         : format == BLOCK_FORMAT_BC3 ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+                                      : GL_COMPRESSED_RED_RGTC1;
+}
+
+// False when internalFormat isn't one of the block formats above
+inline bool blockFormatFromGL(GLenum internalFormat, BlockFormat &format)
+{
+    switch (internalFormat)
+    {
+        case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: format = BLOCK_FORMAT_BC1; return true;
+        case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: format = BLOCK_FORMAT_BC3; return true;
+        case GL_COMPRESSED_RED_RGTC1: format = BLOCK_FORMAT_BC4; return true;
+        default: return false;
+    }
+}
+
+inline size_t blockFormatBytes(BlockFormat format)
+{
+    return format == BLOCK_FORMAT_BC3 ? 16 : 8;
+}
+
+// Size of a width x height image in the format, partial blocks at the edges count as whole ones
+inline size_t blockCompressedSize(BlockFormat format, GLuint width, GLuint height)
+{
+    return size_t((width + 3) / 4) * ((height + 3) / 4) * blockFormatBytes(format);
+}
+
+// Encoding follows "Real-Time DXT Compression" (van Waveren): the endpoints are the corners of the
+// block's bounding box, moved inwards a little, and every texel takes the palette entry nearest to
+// its projection on the line between them. Not the best quality an encoder can get, but fast enough
+// for whole texture sets and close to what slower fitting gets on photographic textures.
+
+// Palette position (0 at the low endpoint to 3 at the high one) to BC1 index, and the same for 8 values
+const GLubyte BC1_INDICES[4] = { 1, 3, 2, 0 };
+const GLubyte BC4_INDICES[8] = { 1, 7, 6, 5, 4, 3, 2, 0 };
+
+inline uint16_t blockPack565(const GLubyte *rgb)
+{
+    return static_cast<uint16_t>(((rgb[0] >> 3) << 11) | ((rgb[1] >> 2) << 5) | (rgb[2] >> 3));
+}
+
+inline void blockUnpack565(uint16_t color, GLubyte *rgb)
+{
+    GLubyte r = (color >> 11) & 31, g = (color >> 5) & 63, b = color & 31;
+    rgb[0] = static_cast<GLubyte>((r << 3) | (r >> 2));
+    rgb[1] = static_cast<GLubyte>((g << 2) | (g >> 4));
+    rgb[2] = static_cast<GLubyte>((b << 3) | (b >> 2));
+}
+
+inline void blockColorBoundsScalar(const GLubyte *rgba, GLubyte *low, GLubyte *high)
+{
+    std::memcpy(low, rgba, 4);
+    std::memcpy(high, rgba, 4);
+    for (int i = 1; i < 16; i++)
+        for (int c = 0; c < 4; c++)
+        {
+            low[c] = std::min(low[c], rgba[i * 4 + c]);
+            high[c] = std::max(high[c], rgba[i * 4 + c]);
+        }
+}
+
+// Palette position of every texel: its projection on direction, from lowDot (0) to lowDot + range (3)
+inline void blockColorPositionsScalar(const GLubyte *rgba, const int *direction, int lowDot, int range, int *positions)
+{
+    for (int i = 0; i < 16; i++)
+    {
+        const GLubyte *p = rgba + i * 4;
+        int scaled = (p[0] * direction[0] + p[1] * direction[1] + p[2] * direction[2] - lowDot) * 6;
+        positions[i] = (scaled > range) + (scaled > 3 * range) + (scaled > 5 * range);
+    }
+}
+
+#if defined(__SSE2__)
+inline void blockColorBoundsSse2(const GLubyte *rgba, GLubyte *low, GLubyte *high)
+{
+    // Four texels per register: reduce the rows, then the texels within the register
+    const __m128i *rows = reinterpret_cast<const __m128i*>(rgba);
+    __m128i lo = _mm_min_epu8(_mm_min_epu8(_mm_loadu_si128(rows), _mm_loadu_si128(rows + 1)),
+                              _mm_min_epu8(_mm_loadu_si128(rows + 2), _mm_loadu_si128(rows + 3)));
+    __m128i hi = _mm_max_epu8(_mm_max_epu8(_mm_loadu_si128(rows), _mm_loadu_si128(rows + 1)),
+                              _mm_max_epu8(_mm_loadu_si128(rows + 2), _mm_loadu_si128(rows + 3)));
+    lo = _mm_min_epu8(lo, _mm_shuffle_epi32(lo, _MM_SHUFFLE(1, 0, 3, 2)));
+    lo = _mm_min_epu8(lo, _mm_shuffle_epi32(lo, _MM_SHUFFLE(2, 3, 0, 1)));
+    hi = _mm_max_epu8(hi, _mm_shuffle_epi32(hi, _MM_SHUFFLE(1, 0, 3, 2)));
+    hi = _mm_max_epu8(hi, _mm_shuffle_epi32(hi, _MM_SHUFFLE(2, 3, 0, 1)));
+    int l = _mm_cvtsi128_si32(lo), h = _mm_cvtsi128_si32(hi);
+    std::memcpy(low, &l, 4);
+    std::memcpy(high, &h, 4);
+}
+
+inline void blockColorPositionsSse2(const GLubyte *rgba, const int *direction, int lowDot, int range, int *positions)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i weights = _mm_setr_epi16(direction[0], direction[1], direction[2], 0,
+                                           direction[0], direction[1], direction[2], 0);
+    const __m128i low = _mm_set1_epi32(lowDot);
+    const __m128i step1 = _mm_set1_epi32(range), step3 = _mm_set1_epi32(3 * range), step5 = _mm_set1_epi32(5 * range);
+    for (int i = 0; i < 16; i += 4)
+    {
+        // Widen to 16 bits, two texels per register; madd leaves (r*dr + g*dg, b*db) per texel
+        __m128i texels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rgba + i * 4));
+        __m128 a = _mm_castsi128_ps(_mm_madd_epi16(_mm_unpacklo_epi8(texels, zero), weights));
+        __m128 b = _mm_castsi128_ps(_mm_madd_epi16(_mm_unpackhi_epi8(texels, zero), weights));
+        __m128i dot = _mm_add_epi32(_mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0))),
+                                    _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1))));
+        // (dot - lowDot) * 6 without SSE4.1's 32 bit multiply
+        __m128i offset = _mm_sub_epi32(dot, low);
+        __m128i scaled = _mm_add_epi32(_mm_slli_epi32(offset, 2), _mm_slli_epi32(offset, 1));
+        // Each comparison is -1 where it holds
+        __m128i position = _mm_add_epi32(_mm_add_epi32(_mm_cmpgt_epi32(scaled, step1), _mm_cmpgt_epi32(scaled, step3)),
+                                         _mm_cmpgt_epi32(scaled, step5));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(positions + i), _mm_sub_epi32(zero, position));
+    }
+}
+#endif
+
+// Encodes 16 RGBA texels (rows of 4, alpha ignored) into an 8 byte BC1 block, always in 4 color mode
+inline void encodeColorBlock(MipSimd simd, const GLubyte *rgba, GLubyte *block)
+{
+    GLubyte low[4], high[4];
+#if defined(__SSE2__)
+    if (simd != MIP_SIMD_SCALAR)
+        blockColorBoundsSse2(rgba, low, high);
+    else
+#endif
+        blockColorBoundsScalar(rgba, low, high);
+    // Inset the box by 1/16 of its size, the endpoints are rarely the best fit for the texels in between
+    for (int c = 0; c < 3; c++)
+    {
+        int inset = (high[c] - low[c]) >> 4;
+        low[c] = static_cast<GLubyte>(low[c] + inset);
+        high[c] = static_cast<GLubyte>(high[c] - inset);
+    }
+
+    // high >= low on every channel, so color0 >= color1 and the block is in 4 color mode unless they're equal
+    uint16_t color0 = blockPack565(high), color1 = blockPack565(low);
+    uint32_t indices = 0;
+    if (color0 != color1)
+    {
+        GLubyte end0[3], end1[3];
+        blockUnpack565(color0, end0);
+        blockUnpack565(color1, end1);
+        int direction[3] = { end0[0] - end1[0], end0[1] - end1[1], end0[2] - end1[2] };
+        int lowDot = end1[0] * direction[0] + end1[1] * direction[1] + end1[2] * direction[2];
+        int range = direction[0] * direction[0] + direction[1] * direction[1] + direction[2] * direction[2];
+        int positions[16];
+#if defined(__SSE2__)
+        if (simd != MIP_SIMD_SCALAR)
+            blockColorPositionsSse2(rgba, direction, lowDot, range, positions);
+        else
+#endif
+            blockColorPositionsScalar(rgba, direction, lowDot, range, positions);
+        for (int i = 0; i < 16; i++)
+            indices |= uint32_t(BC1_INDICES[positions[i]]) << (2 * i);
+    }
+    // Little endian throughout
+    block[0] = static_cast<GLubyte>(color0);
+    block[1] = static_cast<GLubyte>(color0 >> 8);
+    block[2] = static_cast<GLubyte>(color1);
+    block[3] = static_cast<GLubyte>(color1 >> 8);
+    for (int i = 0; i < 4; i++)
+        block[4 + i] = static_cast<GLubyte>(indices >> (8 * i));
+}
+
+// Encodes 16 values of one channel, `stride` bytes apart, into an 8 byte BC4 block (also the alpha half of BC3)
+inline void encodeValueBlock(const GLubyte *values, int stride, GLubyte *block)
+{
+    GLubyte low = values[0], high = values[0];
+    for (int i = 1; i < 16; i++)
+    {
+        low = std::min(low, values[i * stride]);
+        high = std::max(high, values[i * stride]);
+    }
+    // value0 > value1 selects the mode with 6 values in between. Equal values leave every index 0.
+    uint64_t indices = 0;
+    int range = high - low;
+    if (range > 0)
+    {
+        for (int i = 0; i < 16; i++)
+        {
+            int scaled = (values[i * stride] - low) * 14;
+            int position = 0;
+            for (int step = 1; step < 14; step += 2)
+                position += scaled > step * range;
+            indices |= uint64_t(BC4_INDICES[position]) << (3 * i);
+        }
+    }
+    block[0] = high;
+    block[1] = low;
+    for (int i = 0; i < 6; i++)
+        block[2 + i] = static_cast<GLubyte>(indices >> (8 * i));
+}
+
+// Decodes a BC1 block into 16 RGBA texels. BC3's color half is always in 4 color mode.
+inline void decodeColorBlock(const GLubyte *block, bool alwaysFourColors, GLubyte *rgba)
+{
+    uint16_t color0 = static_cast<uint16_t>(block[0] | (block[1] << 8));
+    uint16_t color1 = static_cast<uint16_t>(block[2] | (block[3] << 8));
+    GLubyte palette[4][4];
+    blockUnpack565(color0, palette[0]);
+    blockUnpack565(color1, palette[1]);
+    palette[0][3] = palette[1][3] = 255;
+    bool fourColors = alwaysFourColors || color0 > color1;
+    for (int c = 0; c < 3; c++)
+    {
+        if (fourColors)
+        {
+            palette[2][c] = static_cast<GLubyte>((2 * palette[0][c] + palette[1][c]) / 3);
+            palette[3][c] = static_cast<GLubyte>((palette[0][c] + 2 * palette[1][c]) / 3);
+        }
+        else
+        {
+            palette[2][c] = static_cast<GLubyte>((palette[0][c] + palette[1][c]) / 2);
+            palette[3][c] = 0;
+        }
+    }
+    palette[2][3] = 255;
+    palette[3][3] = fourColors ? 255 : 0;
+    uint32_t indices = block[4] | (block[5] << 8) | (block[6] << 16) | (uint32_t(block[7]) << 24);
+    for (int i = 0; i < 16; i++)
+        std::memcpy(rgba + i * 4, palette[(indices >> (2 * i)) & 3], 4);
+}
+
+// Decodes a BC4 block into 16 values, `stride` bytes apart
+inline void decodeValueBlock(const GLubyte *block, GLubyte *values, int stride)
+{
+    int value0 = block[0], value1 = block[1];
+    GLubyte palette[8];
+    palette[0] = block[0];
+    palette[1] = block[1];
+    if (value0 > value1)
+    {
+        for (int i = 1; i < 7; i++)
+            palette[1 + i] = static_cast<GLubyte>(((7 - i) * value0 + i * value1) / 7);
+    }
+    else
+    {
+        for (int i = 1; i < 5; i++)
+            palette[1 + i] = static_cast<GLubyte>(((5 - i) * value0 + i * value1) / 5);
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+    uint64_t indices = 0;
+    for (int i = 0; i < 6; i++)
+        indices |= uint64_t(block[2 + i]) << (8 * i);
+    for (int i = 0; i < 16; i++)
+        values[i * stride] = palette[(indices >> (3 * i)) & 7];
+}
+
+// Decodes a whole image, for contexts that can't sample the format. `channels` texels are written:
+// 3 or 4 for BC1 and BC3, 1 for BC4. Rows are tightly packed like the cooked textures.
+inline void decompressBlocks(BlockFormat format, const GLubyte *blocks, GLuint width, GLuint height,
+                             int channels, GLubyte *pixels)
+{
+    size_t blockBytes = blockFormatBytes(format);
+    GLubyte rgba[64];
+    for (GLuint by = 0; by < height; by += 4)
+        for (GLuint bx = 0; bx < width; bx += 4, blocks += blockBytes)
+        {
+            if (format == BLOCK_FORMAT_BC4)
+            {
+                decodeValueBlock(blocks, rgba, 4);
+            }
+            else
+            {
+                decodeColorBlock(blocks + (format == BLOCK_FORMAT_BC3 ? 8 : 0), format == BLOCK_FORMAT_BC3, rgba);
+                if (format == BLOCK_FORMAT_BC3)
+                    decodeValueBlock(blocks, rgba + 3, 4);
+            }
+            for (GLuint y = 0; y < 4 && by + y < height; y++)
+                for (GLuint x = 0; x < 4 && bx + x < width; x++)
+                    std::memcpy(pixels + ((by + y) * size_t(width) + bx + x) * channels, rgba + (y * 4 + x) * 4, channels);
+        }
+}
+
+// Compresses images into block formats, offline: rows of blocks are split across threads and the
+// color blocks use SSE2 where the CPU has it.
+class BlockCompressor : public RowWorkers
+{
+public:
+    // threadCount 0 uses every core
+    BlockCompressor(unsigned threadCount = 0)
+        : RowWorkers(threadCount)
+    {
+    }
+
+    // Compresses a width x height image of `channels` channels (1 to 4, rows tightly packed) into `blocks`.
+    // BC1 and BC3 read the first three channels as color, BC3 the fourth as alpha (opaque if there is none),
+    // BC4 the first channel. Edge blocks of images that aren't a multiple of 4 repeat the last row and column.
+    void compress(const GLubyte *pixels, GLuint width, GLuint height, int channels, BlockFormat format,
+                  std::vector<GLubyte> &blocks) const
+    {
+        GLuint blocksWide = (width + 3) / 4, blocksHigh = (height + 3) / 4;
+        size_t blockBytes = blockFormatBytes(format);
+        blocks.resize(size_t(blocksWide) * blocksHigh * blockBytes);
+        forEachRows(blocksHigh, BLOCK_ROWS_PER_THREAD, [&](GLuint first, GLuint last) {
+            GLubyte rgba[64];
+            for (GLuint by = first; by < last; by++)
+                for (GLuint bx = 0; bx < blocksWide; bx++)
+                {
+                    gatherBlock(pixels, width, height, channels, bx * 4, by * 4, rgba);
+                    GLubyte *block = &blocks[(size_t(by) * blocksWide + bx) * blockBytes];
+                    if (format == BLOCK_FORMAT_BC4)
+                        encodeValueBlock(rgba, 4, block);
+                    else if (format == BLOCK_FORMAT_BC3)
+                    {
+                        encodeValueBlock(rgba + 3, 4, block);
+                        encodeColorBlock(simd, rgba, block + 8);
+                    }
+                    else
+                        encodeColorBlock(simd, rgba, block);
+                }
+        });
+    }
+
+private:
+    // Copies the 4x4 texels at (x, y) as RGBA, clamping at the edges
+    static void gatherBlock(const GLubyte *pixels, GLuint width, GLuint height, int channels,
+                            GLuint x, GLuint y, GLubyte *rgba)
+    {
+        for (GLuint row = 0; row < 4; row++)
+        {
+            const GLubyte *source = pixels + size_t(std::min(y + row, height - 1)) * width * channels;
+            for (GLuint column = 0; column < 4; column++)
+            {
+                const GLubyte *texel = source + size_t(std::min(x + column, width - 1)) * channels;
+                GLubyte *target = rgba + (row * 4 + column) * 4;
+                target[0] = texel[0];
+                target[1] = channels >= 3 ? texel[1] : texel[0];
+                target[2] = channels >= 3 ? texel[2] : texel[0];
+                target[3] = channels == 4 ? texel[3] : channels == 2 ? texel[1] : 255;
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,281 @@
+#ifndef COOKED_TEXTURE_H
+#define COOKED_TEXTURE_H
+
+#include <glad/glad.h>
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "BlockCompressor.hpp"
+#include "GLExtensions.hpp"
+
+// Cooked textures are written offline by tools/texture_cooker and hold every mip level already in
+// the final GL format, like a KTX file: loading one is an mmap and one glTexImage2D per level,
+// no image decoding and no mipmap generation.
+//
+// Layout: header, one CookedTextureLevel per mip level, then the levels' pixels. Rows are tightly
+// packed (GL_UNPACK_ALIGNMENT 1), bottom row first, and every level starts on a 64 byte boundary.
+// A block compressed texture (see BlockCompressor.hpp) stores rows of blocks instead, bottom first too.
+const char COOKED_TEXTURE_MAGIC[8] = { '\xAB', 'C', 'T', 'X', ' ', '1', '\xBB', '\n' };
+const uint32_t COOKED_TEXTURE_VERSION = 1;
+const uint32_t COOKED_TEXTURE_ENDIANNESS = 0x04030201; // Reads back swapped on a machine of the other endianness
+const size_t COOKED_TEXTURE_ALIGNMENT = 64;
+
+struct CookedTextureHeader
+{
+    char magic[8];
+    uint32_t endianness;
+    uint32_t version;
+    uint32_t glType;           // e.g. GL_UNSIGNED_BYTE
+    uint32_t glFormat;         // e.g. GL_RGB, what a block compressed texture decodes to
+    uint32_t glInternalFormat; // e.g. GL_RGB8 or GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+    uint32_t width;
+    uint32_t height;
+    uint32_t levelCount;
+};
+
+struct CookedTextureLevel
+{
+    uint64_t offset; // From the start of the file
+    uint64_t size;
+    uint32_t width;
+    uint32_t height;
+};
+
+// Writes a cooked texture. levels[0] is the full size image, each next one half the size of the previous.
+inline bool writeCookedTexture(const char *path, GLenum type, GLenum format, GLenum internalFormat,
+                               const std::vector<CookedTextureLevel> &levels,
+                               const std::vector< std::vector<GLubyte> > &pixels)
+{
+    CookedTextureHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, COOKED_TEXTURE_MAGIC, sizeof(header.magic));
+    header.endianness = COOKED_TEXTURE_ENDIANNESS;
+    header.version = COOKED_TEXTURE_VERSION;
+    header.glType = type;
+    header.glFormat = format;
+    header.glInternalFormat = internalFormat;
+    header.width = levels.empty() ? 0 : levels[0].width;
+    header.height = levels.empty() ? 0 : levels[0].height;
+    header.levelCount = static_cast<uint32_t>(levels.size());
+
+    // Lay the levels out after the table, each one aligned
+    std::vector<CookedTextureLevel> table(levels);
+    uint64_t offset = sizeof(header) + table.size() * sizeof(CookedTextureLevel);
+    for (size_t i = 0; i < table.size(); i++)
+    {
+        offset = (offset + COOKED_TEXTURE_ALIGNMENT - 1) / COOKED_TEXTURE_ALIGNMENT * COOKED_TEXTURE_ALIGNMENT;
+        table[i].offset = offset;
+        table[i].size = pixels[i].size();
+        offset += table[i].size;
+    }
+
+    FILE *file = std::fopen(path, "wb");
+    if (!file)
+        return false;
+    bool written = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   (table.empty() ||
+                    std::fwrite(&table[0], sizeof(CookedTextureLevel), table.size(), file) == table.size());
+    const char zeros[COOKED_TEXTURE_ALIGNMENT] = {};
+    for (size_t i = 0; written && i < table.size(); i++)
+    {
+        size_t padding = static_cast<size_t>(table[i].offset - std::ftell(file));
+        written = (padding == 0 || std::fwrite(zeros, 1, padding, file) == padding) &&
+                  (pixels[i].empty() || std::fwrite(&pixels[i][0], 1, pixels[i].size(), file) == pixels[i].size());
+    }
+    written = std::fclose(file) == 0 && written;
+    if (!written)
+        std::remove(path);
+    return written;
+}
+
+// Where the cookTextures target puts the cooked version of an image: assets/x.jpg -> assets/cooked/x.tex
+inline std::string cookedTexturePath(const std::string &imagePath)
+{
+    size_t slash = imagePath.find_last_of('/');
+    size_t nameStart = slash == std::string::npos ? 0 : slash + 1;
+    size_t dot = imagePath.find_last_of('.');
+    if (dot == std::string::npos || dot < nameStart)
+        dot = imagePath.size();
+    return imagePath.substr(0, nameStart) + "cooked/" + imagePath.substr(nameStart, dot - nameStart) + ".tex";
+}
+
+// Whether the current context samples the block format: RGTC is core since GL 3.0, S3TC an extension
+inline bool blockFormatSupported(BlockFormat format)
+{
+    static const bool s3tc = hasGLExtension("GL_EXT_texture_compression_s3tc");
+    return format == BLOCK_FORMAT_BC4 || s3tc;
+}
+
+// A cooked texture mapped from disk, levels are uploaded straight from the mapping.
+// Block compressed levels the context can't sample are decoded on the CPU first.
+class MappedCookedTexture
+{
+public:
+    MappedCookedTexture()
+        : data(NULL), size(0)
+    {
+    }
+
+    ~MappedCookedTexture()
+    {
+        unmap();
+    }
+
+    // Fails when the file is missing, and says so when it isn't a valid cooked texture
+    bool open(const char *path)
+    {
+        unmap();
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat info;
+        if (fstat(fd, &info) == 0 && static_cast<size_t>(info.st_size) >= sizeof(CookedTextureHeader))
+        {
+            void *mapped = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED)
+            {
+                data = static_cast<const GLubyte*>(mapped);
+                size = info.st_size;
+            }
+        }
+        ::close(fd);
+        if (!data)
+            return false;
+
+        const CookedTextureHeader &h = header();
+        bool valid = std::memcmp(h.magic, COOKED_TEXTURE_MAGIC, sizeof(h.magic)) == 0 &&
+                     h.endianness == COOKED_TEXTURE_ENDIANNESS && h.version == COOKED_TEXTURE_VERSION &&
+                     h.levelCount > 0 && h.width > 0 && h.height > 0 &&
+                     sizeof(CookedTextureHeader) + h.levelCount * sizeof(CookedTextureLevel) <= size &&
+                     h.glType == GL_UNSIGNED_BYTE &&
+                     (h.glFormat == GL_RED || h.glFormat == GL_RG || h.glFormat == GL_RGB || h.glFormat == GL_RGBA);
+        BlockFormat format = BLOCK_FORMAT_BC1;
+        bool compressed = blockFormatFromGL(h.glInternalFormat, format);
+        // Every level has to be exactly as big as GL will read it, or a stale or truncated file would
+        // send glTexImage2D past the end of the mapping
+        uint32_t width = h.width;
+        uint32_t height = h.height;
+        for (uint32_t i = 0; valid && i < h.levelCount; i++)
+        {
+            const CookedTextureLevel &l = level(i);
+            uint64_t expected = compressed ? blockCompressedSize(format, l.width, l.height)
+                                           : uint64_t(l.width) * l.height * formatChannels(h.glFormat);
+            valid = l.width == width && l.height == height && l.offset <= size && l.size <= size - l.offset &&
+                    l.size == expected;
+            width = width > 1 ? width / 2 : 1;
+            height = height > 1 ? height / 2 : 1;
+        }
+        if (!valid)
+        {
+            std::cout << "Invalid cooked texture " << path << std::endl;
+            unmap();
+        }
+        return valid;
+    }
+
+    const CookedTextureHeader &header() const
+    {
+        return *reinterpret_cast<const CookedTextureHeader*>(data);
+    }
+
+    const CookedTextureLevel &level(uint32_t i) const
+    {
+        return reinterpret_cast<const CookedTextureLevel*>(data + sizeof(CookedTextureHeader))[i];
+    }
+
+    // Uploads level i into the bound GL_TEXTURE_2D. Returns residentSize(i).
+    size_t upload(uint32_t i) const
+    {
+        const CookedTextureHeader &h = header();
+        const CookedTextureLevel &l = level(i);
+        BlockFormat format;
+        if (!blockFormatFromGL(h.glInternalFormat, format))
+            glTexImage2D(GL_TEXTURE_2D, i, h.glInternalFormat, l.width, l.height, 0, h.glFormat, h.glType, data + l.offset);
+        else if (blockFormatSupported(format))
+            glCompressedTexImage2D(GL_TEXTURE_2D, i, h.glInternalFormat, l.width, l.height, 0, l.size, data + l.offset);
+        else
+        {
+            std::vector<GLubyte> pixels(residentSize(i));
+            decompressBlocks(format, data + l.offset, l.width, l.height, formatChannels(h.glFormat), &pixels[0]);
+            glTexImage2D(GL_TEXTURE_2D, i, h.glFormat, l.width, l.height, 0, h.glFormat, h.glType, &pixels[0]);
+        }
+        return residentSize(i);
+    }
+
+    // Gives the memory of level i of the bound GL_TEXTURE_2D back by respecifying it as 0x0
+    void release(uint32_t i) const
+    {
+        const CookedTextureHeader &h = header();
+        BlockFormat format;
+        if (!blockFormatFromGL(h.glInternalFormat, format))
+            glTexImage2D(GL_TEXTURE_2D, i, h.glInternalFormat, 0, 0, 0, h.glFormat, h.glType, NULL);
+        else if (blockFormatSupported(format))
+            glCompressedTexImage2D(GL_TEXTURE_2D, i, h.glInternalFormat, 0, 0, 0, 0, NULL);
+        else
+            glTexImage2D(GL_TEXTURE_2D, i, h.glFormat, 0, 0, 0, h.glFormat, h.glType, NULL);
+    }
+
+    // Bytes level i takes in texture memory: its size in the file, unless it has to be decoded
+    size_t residentSize(uint32_t i) const
+    {
+        const CookedTextureHeader &h = header();
+        const CookedTextureLevel &l = level(i);
+        BlockFormat format;
+        if (!blockFormatFromGL(h.glInternalFormat, format) || blockFormatSupported(format))
+            return l.size;
+        return size_t(l.width) * l.height * formatChannels(h.glFormat);
+    }
+
+private:
+    MappedCookedTexture(const MappedCookedTexture &);
+    MappedCookedTexture &operator=(const MappedCookedTexture &);
+
+    static int formatChannels(GLenum format)
+    {
+        return format == GL_RGBA ? 4 : format == GL_RGB ? 3 : format == GL_RG ? 2 : 1;
+    }
+
+    void unmap()
+    {
+        if (data)
+            munmap(const_cast<GLubyte*>(data), size);
+        data = NULL;
+        size = 0;
+    }
+
+    const GLubyte *data;
+    size_t size;
+};
+
+// Uploads every level of a cooked texture straight from the mapped file. Returns the bytes uploaded,
+// or 0, leaving the texture untouched, when the file is missing or not a valid cooked texture.
+inline size_t loadCookedTexture(GLuint texture, const char *path, int wrap_s, int wrap_t, int min_filter, int mag_filter)
+{
+    MappedCookedTexture cooked;
+    if (!cooked.open(path))
+        return 0;
+
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap_s);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap_t);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, min_filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, mag_filter);
+    // The chain may stop before 1x1, only sample the levels that are there
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, cooked.header().levelCount - 1);
+    size_t uploaded = 0;
+    for (uint32_t i = 0; i < cooked.header().levelCount; i++)
+        uploaded += cooked.upload(i);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return uploaded;
+}
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef FRAME_GLOBALS_H
+#define FRAME_GLOBALS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <iostream>
+
+// Uniform buffer binding point of the FrameGlobals block. GLSL 3.30 can't say it with layout(binding),
+// Shader points every program's block here after linking.
+const GLuint FRAME_GLOBALS_BINDING = 0;
+
+// The FrameGlobals uniform block of GLSL/frame_globals.glsl, byte for byte: std140 puts a mat4 and vec4s
+// at 16 byte boundaries with no padding, the same as glm. Keep both in sync.
+struct FrameGlobalsBlock
+{
+    glm::mat4 projection; // Orthographic, in window coordinates
+    glm::vec4 viewport;   // Framebuffer width, height, 1 / width, 1 / height in pixels
+    glm::vec4 time;       // Seconds since start, seconds since the last frame, unused, unused
+};
+static_assert(sizeof(FrameGlobalsBlock) == 96, "FrameGlobalsBlock has to match the std140 layout");
+
+// What every shader needs to know about the frame, in one uniform buffer bound once for all programs.
+// It is written once a frame whatever the number of programs, instead of a glUniform* per program.
+class FrameGlobals
+{
+public:
+    FrameGlobals()
+        : ubo(0), uploads(0)
+    {
+    }
+
+    void init()
+    {
+        glGenBuffers(1, &ubo);
+        glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameGlobalsBlock), NULL, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_GLOBALS_BINDING, ubo);
+    }
+
+    // Once a frame, before the first draw
+    void update(const glm::mat4 &projection, GLint framebufferWidth, GLint framebufferHeight, GLfloat seconds,
+                GLfloat frameSeconds)
+    {
+        FrameGlobalsBlock block;
+        block.projection = projection;
+        GLfloat width = static_cast<GLfloat>(framebufferWidth > 0 ? framebufferWidth : 1);
+        GLfloat height = static_cast<GLfloat>(framebufferHeight > 0 ? framebufferHeight : 1);
+        block.viewport = glm::vec4(width, height, 1.0f / width, 1.0f / height);
+        block.time = glm::vec4(seconds, frameSeconds, 0.0f, 0.0f);
+        glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+        // Orphan the old storage so we never wait on the previous frame's draws
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(block), &block, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        uploads++;
+    }
+
+    void printStats() const
+    {
+        std::cout << "Frame globals: " << uploads << " uploads of " << sizeof(FrameGlobalsBlock) << " bytes"
+                  << std::endl;
+    }
+
+    void destroy()
+    {
+        glDeleteBuffers(1, &ubo);
+        ubo = 0;
+    }
+
+private:
+    GLuint ubo;
+    size_t uploads;
+};
+
+#endif
@@ -0,0 +1,238 @@
+#ifndef GLYPH_RENDERER_H
+#define GLYPH_RENDERER_H
+
+#include <glad/glad.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <thread>
+#include <vector>
+
+#include "SdfGenerator.hpp"
+#include "FontManager.hpp"
+
+// Tightly packed image of one glyph, rows top to bottom
+struct GlyphImage
+{
+    int width;
+    int rows;
+    int left;
+    int top;
+    long advance; // 1/64 pixels, like FreeType
+    std::vector<GLubyte> pixels;
+};
+
+// Turns codepoints of a face into glyph images on the CPU: FreeType bitmaps, or distance fields.
+// Doesn't touch OpenGL. Glyphs come either from a face the caller owns, which lets any thread that owns
+// the face use it, or from a FontManager font whose faces and glyphs stay in FreeType's caches.
+class GlyphRenderer
+{
+public:
+    GlyphRenderer(int sdfSpread)
+        : face(NULL), fonts(NULL), font(0), pixelSize(0), sdf(false), sdfGenerator(sdfSpread)
+    {
+    }
+
+    void setFace(FT_Face fontFace, bool useSdf)
+    {
+        face = fontFace;
+        fonts = NULL;
+        sdf = useSdf;
+    }
+
+    void setFont(FontManager &manager, FontId fontId, FT_UInt size, bool useSdf)
+    {
+        face = NULL;
+        fonts = &manager;
+        font = fontId;
+        pixelSize = size;
+        sdf = useSdf;
+    }
+
+    bool isSdf() const { return sdf; }
+
+    bool hasGlyph(GLuint codepoint)
+    {
+        return (fonts ? fonts->glyphIndex(font, codepoint) : FT_Get_Char_Index(face, codepoint)) != 0;
+    }
+
+    bool render(GLuint codepoint, GlyphImage &out)
+    {
+        if (fonts)
+            return renderCached(codepoint, out);
+
+        // Distance fields are built from the unhinted outline instead of a bitmap
+        FT_Int32 loadFlags = sdf ? FT_LOAD_NO_BITMAP | FT_LOAD_NO_HINTING : FT_LOAD_RENDER;
+        if (FT_Load_Char(face, codepoint, loadFlags))
+            return false;
+        out.advance = face->glyph->advance.x;
+        if (sdf)
+            return sdfGenerator.generate(face->glyph, field) && takeField(out);
+        FT_Bitmap &bitmap = face->glyph->bitmap;
+        copyBitmap(bitmap.buffer, bitmap.width, bitmap.rows, bitmap.pitch, out);
+        out.left = face->glyph->bitmap_left;
+        out.top = face->glyph->bitmap_top;
+        return true;
+    }
+
+private:
+    // Same images as render, but loaded through the font manager's glyph caches
+    bool renderCached(GLuint codepoint, GlyphImage &out)
+    {
+        FT_UInt glyph = fonts->glyphIndex(font, codepoint);
+        FT_Glyph image;
+        if (sdf)
+        {
+            if (!fonts->image(font, pixelSize, glyph, FT_LOAD_NO_BITMAP | FT_LOAD_NO_HINTING, image) ||
+                image->format != FT_GLYPH_FORMAT_OUTLINE)
+                return false;
+            out.advance = image->advance.x >> 10; // 16.16 to 26.6
+            return sdfGenerator.generate(&reinterpret_cast<FT_OutlineGlyph>(image)->outline, field) && takeField(out);
+        }
+
+        // Small bitmaps come from the compact sbit cache, anything bigger from the image cache
+        FTC_SBit sbit;
+        if (!fonts->bitmap(font, pixelSize, glyph, FT_LOAD_RENDER, sbit))
+            return false;
+        if (sbit->buffer || (sbit->width == 0 && sbit->height == 0))
+        {
+            copyBitmap(sbit->buffer, sbit->width, sbit->height, sbit->pitch, out);
+            out.left = sbit->left;
+            out.top = sbit->top;
+            out.advance = sbit->xadvance * 64;
+            return true;
+        }
+        if (!fonts->image(font, pixelSize, glyph, FT_LOAD_RENDER, image) || image->format != FT_GLYPH_FORMAT_BITMAP)
+            return false;
+        FT_BitmapGlyph bitmapGlyph = reinterpret_cast<FT_BitmapGlyph>(image);
+        copyBitmap(bitmapGlyph->bitmap.buffer, bitmapGlyph->bitmap.width, bitmapGlyph->bitmap.rows,
+                   bitmapGlyph->bitmap.pitch, out);
+        out.left = bitmapGlyph->left;
+        out.top = bitmapGlyph->top;
+        out.advance = image->advance.x >> 10;
+        return true;
+    }
+
+    bool takeField(GlyphImage &out)
+    {
+        out.width = field.width;
+        out.rows = field.rows;
+        out.left = field.left;
+        out.top = field.top;
+        out.pixels.swap(field.pixels);
+        return true;
+    }
+
+    static void copyBitmap(const GLubyte *buffer, int width, int rows, int pitch, GlyphImage &out)
+    {
+        out.width = width;
+        out.rows = rows;
+        out.pixels.resize(width * rows);
+        for (int row = 0; row < rows; row++)
+            std::copy(buffer + row * pitch, buffer + row * pitch + width, out.pixels.begin() + row * width);
+    }
+
+    FT_Face face;
+    FontManager *fonts;
+    FontId font;
+    FT_UInt pixelSize;
+    bool sdf;
+    SdfGenerator sdfGenerator;
+    SdfBitmap field;
+};
+
+// Timing of a rasterizeGlyphs call. busyMs adds up the CPU time of every thread, i.e. about what
+// a single thread would have needed; busyMs / wallMs is the speedup.
+struct GlyphRasterStats
+{
+    unsigned threads;
+    double wallMs;
+    double busyMs;
+};
+
+// CPU time of the calling thread. Unlike wall time it doesn't grow while the thread waits for a core.
+inline double threadCpuMs()
+{
+    timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+// Glyphs a worker takes at once, small enough to keep every thread busy until the end
+const size_t GLYPH_RASTER_BATCH = 4;
+
+// One rasterizeGlyphs thread, with its own FreeType library and face
+inline void rasterizeWorker(const char *fontPath, FT_UInt pixelSize, bool sdf, int sdfSpread,
+                            const std::vector<GLuint> *codepoints, std::vector<GlyphImage> *images,
+                            std::vector<GLubyte> *loaded, std::atomic<size_t> *next, double *busyMs)
+{
+    double begin = threadCpuMs();
+    FT_Library ft;
+    if (FT_Init_FreeType(&ft))
+        return;
+    FT_Face face;
+    if (FT_New_Face(ft, fontPath, 0, &face))
+    {
+        FT_Done_FreeType(ft);
+        return;
+    }
+    FT_Set_Pixel_Sizes(face, 0, pixelSize);
+    GlyphRenderer renderer(sdfSpread);
+    renderer.setFace(face, sdf);
+
+    size_t first;
+    while ((first = next->fetch_add(GLYPH_RASTER_BATCH)) < codepoints->size())
+    {
+        size_t last = std::min(first + GLYPH_RASTER_BATCH, codepoints->size());
+        for (size_t i = first; i < last; i++)
+            (*loaded)[i] = renderer.render((*codepoints)[i], (*images)[i]) ? 1 : 0;
+    }
+
+    FT_Done_Face(face);
+    FT_Done_FreeType(ft);
+    *busyMs = threadCpuMs() - begin;
+}
+
+// Rasterizes a set of codepoints on several threads. FreeType libraries and faces can't be shared
+// between threads, so every worker opens its own from the font file. Glyphs are handed out a few
+// at a time as they are finished, distance fields of complex glyphs take far longer than simple ones.
+// images[i] belongs to codepoints[i]; loaded[i] is 0 when it failed. threadCount 0 uses every core.
+inline GlyphRasterStats rasterizeGlyphs(const char *fontPath, FT_UInt pixelSize, bool sdf, int sdfSpread,
+                                        const std::vector<GLuint> &codepoints, std::vector<GlyphImage> &images,
+                                        std::vector<GLubyte> &loaded, unsigned threadCount = 0)
+{
+    if (threadCount == 0)
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    // No point in threads that would find nothing left to do
+    size_t batches = (codepoints.size() + GLYPH_RASTER_BATCH - 1) / GLYPH_RASTER_BATCH;
+    threadCount = static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(threadCount, batches)));
+    images.resize(codepoints.size());
+    loaded.assign(codepoints.size(), 0);
+
+    std::atomic<size_t> next(0);
+    std::vector<double> busyMs(threadCount, 0.0);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> workers;
+    for (unsigned t = 1; t < threadCount; t++)
+        workers.push_back(std::thread(rasterizeWorker, fontPath, pixelSize, sdf, sdfSpread,
+                                      &codepoints, &images, &loaded, &next, &busyMs[t]));
+    // The calling thread does its share too instead of just waiting
+    rasterizeWorker(fontPath, pixelSize, sdf, sdfSpread, &codepoints, &images, &loaded, &next, &busyMs[0]);
+    for (size_t t = 0; t < workers.size(); t++)
+        workers[t].join();
+
+    GlyphRasterStats stats;
+    stats.threads = threadCount;
+    stats.wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    stats.busyMs = 0.0;
+    for (unsigned t = 0; t < threadCount; t++)
+        stats.busyMs += busyMs[t];
+    return stats;
+}
+
+#endif
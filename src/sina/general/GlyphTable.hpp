@@ -0,0 +1,109 @@
+#ifndef GLYPH_TABLE_H
+#define GLYPH_TABLE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_precision.hpp>
+
+#include <algorithm>
+
+// Compact metrics of one glyph (20 bytes), in pixels of the size the glyphs were rasterized at.
+struct Character {
+    GLushort     AtlasRect[4]; // Rectangle inside the atlas (u0, v0, u1, v1) normalized to 0..65535, v0 at the top
+    glm::i16vec2 Size;         // Size of glyph
+    glm::i16vec2 Bearing;      // Offset from baseline to left/top of glyph
+    GLshort      Advance;      // Offset to advance to next glyph, in 1/8 pixels: at most 4095 pixels
+    GLshort      Padding;
+};
+
+// Character::Advance of a FreeType advance in 1/64 pixels, rounded and clamped to what it can hold
+inline GLshort glyphAdvance(long advance)
+{
+    long eighths = (advance + (advance < 0 ? -4 : 4)) / 8;
+    return static_cast<GLshort>(std::max(-32768L, std::min(32767L, eighths)));
+}
+
+// Provides glyphs for codepoints outside of the dense table, e.g. by rasterizing them on demand
+class GlyphSource
+{
+public:
+    virtual ~GlyphSource() {}
+    // Returns NULL when the font has no glyph for the codepoint
+    virtual const Character *lookup(GLuint codepoint) = 0;
+    // Changes whenever previously returned glyphs may have been invalidated
+    virtual GLuint generation() const = 0;
+};
+
+// Glyph metrics indexed by codepoint. ASCII lives in a flat array so a lookup is one compare
+// and one load, with no copies and no allocations. Codepoints past ASCII go to the fallback
+// source, and anything it can't provide resolves to the "missing" glyph instead of being inserted.
+class GlyphTable
+{
+public:
+    static const GLuint DENSE_SIZE = 128;
+
+    GlyphTable()
+        : fallbackSource(NULL), metricScale(1.0f)
+    {
+        Character empty = {};
+        std::fill(dense, dense + DENSE_SIZE, empty);
+        missing = empty;
+    }
+
+    // Only the dense ASCII range can be set directly, the rest comes from the fallback source
+    void set(GLuint codepoint, const Character &ch)
+    {
+        if (codepoint < DENSE_SIZE)
+            dense[codepoint] = ch;
+    }
+
+    // Glyph drawn for codepoints that are not in the table
+    void setMissing(const Character &ch)
+    {
+        missing = ch;
+    }
+
+    void setFallback(GlyphSource *source)
+    {
+        fallbackSource = source;
+    }
+
+    // Generation of the fallback glyphs; layouts using them must be redone when it changes
+    GLuint fallbackGeneration() const
+    {
+        return fallbackSource ? fallbackSource->generation() : 0;
+    }
+
+    // Glyphs may be rasterized at another size than the nominal font size (distance fields are
+    // built smaller). Layout multiplies the metrics by this factor so text scales stay the same.
+    void setMetricScale(GLfloat scale)
+    {
+        metricScale = scale;
+    }
+
+    GLfloat getMetricScale() const
+    {
+        return metricScale;
+    }
+
+    const Character &get(GLuint codepoint) const
+    {
+        if (codepoint < DENSE_SIZE)
+            return dense[codepoint];
+        return fallback(codepoint);
+    }
+
+private:
+    const Character &fallback(GLuint codepoint) const
+    {
+        const Character *ch = fallbackSource ? fallbackSource->lookup(codepoint) : NULL;
+        return ch ? *ch : missing;
+    }
+
+    Character dense[DENSE_SIZE];
+    GlyphSource *fallbackSource;
+    Character missing;
+    GLfloat metricScale;
+};
+
+#endif
@@ -0,0 +1,544 @@
+#ifndef MIP_GENERATOR_H
+#define MIP_GENERATOR_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+// AVX2 is picked at runtime, the rest of the program doesn't need to be built for it
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define MIP_GENERATOR_AVX2
+#endif
+
+enum MipFilter
+{
+    MIP_FILTER_BOX,     // Average of 2x2 texels, like glGenerateMipmap
+    MIP_FILTER_TRIANGLE // 4x4 texels weighted 1 3 3 1, less aliasing for a little blur
+};
+
+enum MipSimd
+{
+    MIP_SIMD_SCALAR,
+    MIP_SIMD_SSE2,
+    MIP_SIMD_AVX2
+};
+
+// One level of a mip chain, rows bottom to top and tightly packed like the base image
+struct MipLevel
+{
+    GLuint width;
+    GLuint height;
+    std::vector<GLubyte> pixels;
+};
+
+// Output rows per thread below which more threads cost more than they save
+const GLuint MIP_ROWS_PER_THREAD = 16;
+// Steps of the linear to sRGB table, fine enough that every dark sRGB value can be hit
+const int SRGB_ENCODE_STEPS = 16384;
+
+struct SrgbTables
+{
+    float toLinear[256];
+    GLubyte fromLinear[SRGB_ENCODE_STEPS];
+
+    SrgbTables()
+    {
+        for (int i = 0; i < 256; i++)
+        {
+            float s = i / 255.0f;
+            toLinear[i] = s <= 0.04045f ? s / 12.92f : std::pow((s + 0.055f) / 1.055f, 2.4f);
+        }
+        for (int i = 0; i < SRGB_ENCODE_STEPS; i++)
+        {
+            float l = i / float(SRGB_ENCODE_STEPS - 1);
+            float s = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+            fromLinear[i] = static_cast<GLubyte>(s * 255.0f + 0.5f);
+        }
+    }
+};
+
+inline const SrgbTables &srgbTables()
+{
+    static const SrgbTables tables;
+    return tables;
+}
+
+inline MipSimd detectMipSimd()
+{
+#if defined(MIP_GENERATOR_AVX2)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return MIP_SIMD_AVX2;
+#endif
+#if defined(__SSE2__)
+    return MIP_SIMD_SSE2;
+#else
+    return MIP_SIMD_SCALAR;
+#endif
+}
+
+// Box filter of 8 bit texels in two steps: the two source rows are summed into 16 bit lanes,
+// then horizontal pairs of sums are added, rounded and divided by 4. The row sums don't care about
+// the texel layout so they are SIMD for any channel count; the pairs are for 4 channels.
+
+inline void mipSumRowsScalar(const GLubyte *a, const GLubyte *b, GLushort *sums, size_t count, size_t i = 0)
+{
+    for (; i < count; i++)
+        sums[i] = a[i] + b[i];
+}
+
+// (sums[2x] + sums[2x+1] + 2) / 4 for every texel from `first` on. An odd last column is dropped,
+// a 1 texel wide row is repeated.
+inline void mipAveragePairsScalar(const GLushort *sums, GLuint width, int channels,
+                                  GLubyte *target, GLuint targetWidth, GLuint first = 0)
+{
+    for (GLuint x = first; x < targetWidth; x++)
+    {
+        const GLushort *s0 = sums + size_t(2 * x) * channels;
+        const GLushort *s1 = sums + size_t(std::min(2 * x + 1, width - 1)) * channels;
+        for (int k = 0; k < channels; k++)
+            target[size_t(x) * channels + k] = static_cast<GLubyte>((s0[k] + s1[k] + 2) >> 2);
+    }
+}
+
+#if defined(__SSE2__)
+inline void mipSumRowsSse2(const GLubyte *a, const GLubyte *b, GLushort *sums, size_t count)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(sums + i),
+                         _mm_add_epi16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(sums + i + 8),
+                         _mm_add_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero)));
+    }
+    mipSumRowsScalar(a, b, sums, count, i);
+}
+
+inline void mipAveragePairsSse2(const GLushort *sums, GLuint width, int channels,
+                                GLubyte *target, GLuint targetWidth, GLuint first = 0)
+{
+    GLuint x = first;
+    if (channels == 4)
+    {
+        const __m128i two = _mm_set1_epi16(2);
+        for (; x + 2 <= targetWidth; x += 2)
+        {
+            // Texels 2x, 2x+1 and 2x+2, 2x+3: regrouped into (2x, 2x+2) + (2x+1, 2x+3)
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sums + size_t(x) * 8));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sums + size_t(x) * 8 + 8));
+            __m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(a, b), _mm_unpackhi_epi64(a, b));
+            sum = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(target + size_t(x) * 4), _mm_packus_epi16(sum, sum));
+        }
+    }
+    mipAveragePairsScalar(sums, width, channels, target, targetWidth, x);
+}
+#endif
+
+#if defined(MIP_GENERATOR_AVX2)
+__attribute__((target("avx2")))
+inline void mipSumRowsAvx2(const GLubyte *a, const GLubyte *b, GLushort *sums, size_t count)
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m256i va = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)));
+        __m256i vb = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(sums + i), _mm256_add_epi16(va, vb));
+    }
+    mipSumRowsScalar(a, b, sums, count, i);
+}
+
+__attribute__((target("avx2")))
+inline void mipAveragePairsAvx2(const GLushort *sums, GLuint width, int channels,
+                                GLubyte *target, GLuint targetWidth)
+{
+    GLuint x = 0;
+    if (channels == 4)
+    {
+        const __m256i two = _mm256_set1_epi16(2);
+        const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 0, 0, 0, 0);
+        for (; x + 4 <= targetWidth; x += 4)
+        {
+            // Same regrouping as SSE2 within each 128 bit lane, the lanes end up holding
+            // texels (0, 2) and (1, 3) and are put back in order after packing
+            __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(sums + size_t(x) * 8));
+            __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(sums + size_t(x) * 8 + 16));
+            __m256i sum = _mm256_add_epi16(_mm256_unpacklo_epi64(a, b), _mm256_unpackhi_epi64(a, b));
+            sum = _mm256_srli_epi16(_mm256_add_epi16(sum, two), 2);
+            __m256i packed = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(sum, sum), order);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(target + size_t(x) * 4), _mm256_castsi256_si128(packed));
+        }
+    }
+    mipAveragePairsSse2(sums, width, channels, target, targetWidth, x);
+}
+#endif
+
+// Output rows [first, last) of an 8 bit box filtered level
+inline void mipBoxRows(MipSimd simd, const GLubyte *source, GLuint width, GLuint height, int channels,
+                       GLubyte *target, GLuint targetWidth, GLuint first, GLuint last)
+{
+    size_t rowSize = size_t(width) * channels;
+    std::vector<GLushort> sums(rowSize);
+    for (GLuint y = first; y < last; y++)
+    {
+        const GLubyte *row0 = source + size_t(2 * y) * rowSize;
+        const GLubyte *row1 = source + size_t(std::min(2 * y + 1, height - 1)) * rowSize;
+        GLubyte *out = target + size_t(y) * targetWidth * channels;
+        switch (simd)
+        {
+#if defined(MIP_GENERATOR_AVX2)
+        case MIP_SIMD_AVX2:
+            mipSumRowsAvx2(row0, row1, &sums[0], rowSize);
+            mipAveragePairsAvx2(&sums[0], width, channels, out, targetWidth);
+            break;
+#endif
+#if defined(__SSE2__)
+        case MIP_SIMD_SSE2:
+            mipSumRowsSse2(row0, row1, &sums[0], rowSize);
+            mipAveragePairsSse2(&sums[0], width, channels, out, targetWidth);
+            break;
+#endif
+        default:
+            mipSumRowsScalar(row0, row1, &sums[0], rowSize);
+            mipAveragePairsScalar(&sums[0], width, channels, out, targetWidth);
+            break;
+        }
+    }
+}
+
+// sRGB and the triangle filter work on linear light floats. The whole chain is kept as floats so
+// no level is filtered from an already rounded one; only the stored copy is converted back to bytes.
+
+inline bool isAlphaChannel(int channel, int channels)
+{
+    return (channels == 2 || channels == 4) && channel == channels - 1;
+}
+
+inline GLubyte encodeMipTexel(float value, bool srgb, bool alpha)
+{
+    value = std::min(std::max(value, 0.0f), 1.0f);
+    if (srgb && !alpha)
+        return srgbTables().fromLinear[static_cast<int>(value * (SRGB_ENCODE_STEPS - 1) + 0.5f)];
+    return static_cast<GLubyte>(value * 255.0f + 0.5f);
+}
+
+// Rows [first, last) of the base image as linear floats
+inline void mipDecodeRows(const GLubyte *pixels, GLuint width, int channels, bool srgb,
+                          float *linear, GLuint first, GLuint last)
+{
+    const float *toLinear = srgbTables().toLinear;
+    for (size_t i = size_t(first) * width * channels; i < size_t(last) * width * channels; i += channels)
+        for (int k = 0; k < channels; k++)
+            linear[i + k] = srgb && !isAlphaChannel(k, channels) ? toLinear[pixels[i + k]] : pixels[i + k] / 255.0f;
+}
+
+// out[i] = sum of weights[j] * rows[j][i]
+inline void mipWeightRows(MipSimd simd, const float *const *rows, const float *weights, int taps,
+                          float *out, size_t count)
+{
+    size_t i = 0;
+#if defined(__SSE2__)
+    if (simd != MIP_SIMD_SCALAR)
+    {
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128 sum = _mm_mul_ps(_mm_set1_ps(weights[0]), _mm_loadu_ps(rows[0] + i));
+            for (int j = 1; j < taps; j++)
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[j]), _mm_loadu_ps(rows[j] + i)));
+            _mm_storeu_ps(out + i, sum);
+        }
+    }
+#endif
+    for (; i < count; i++)
+    {
+        float sum = 0.0f;
+        for (int j = 0; j < taps; j++)
+            sum += weights[j] * rows[j][i];
+        out[i] = sum;
+    }
+}
+
+// Output rows [first, last) of a level filtered from linear floats, stored as floats and bytes
+inline void mipFilterRows(MipSimd simd, MipFilter filter, bool srgb, const float *source, GLuint width,
+                          GLuint height, int channels, float *target, GLubyte *bytes, GLuint targetWidth,
+                          GLuint first, GLuint last)
+{
+    static const float BOX[2] = { 0.5f, 0.5f };
+    static const float TRIANGLE[4] = { 0.125f, 0.375f, 0.375f, 0.125f };
+    const float *weights = filter == MIP_FILTER_TRIANGLE ? TRIANGLE : BOX;
+    int taps = filter == MIP_FILTER_TRIANGLE ? 4 : 2;
+    int offset = filter == MIP_FILTER_TRIANGLE ? -1 : 0; // Of the first tap from 2x
+
+    const GLubyte *fromLinear = srgbTables().fromLinear;
+#if defined(__SSE2__)
+    float colorScale = srgb ? SRGB_ENCODE_STEPS - 1 : 255.0f;
+    const __m128 scale4 = _mm_setr_ps(colorScale, colorScale, colorScale, 255.0f);
+#endif
+
+    size_t rowSize = size_t(width) * channels;
+    std::vector<float> column(rowSize); // Source row filtered vertically
+    std::vector<size_t> taken(size_t(targetWidth) * taps); // Source texel of every horizontal tap
+    for (GLuint x = 0; x < targetWidth; x++)
+        for (int i = 0; i < taps; i++)
+        {
+            int sx = std::min(std::max(int(2 * x) + offset + i, 0), int(width) - 1);
+            taken[size_t(x) * taps + i] = size_t(sx) * channels;
+        }
+
+    for (GLuint y = first; y < last; y++)
+    {
+        const float *rows[4];
+        for (int j = 0; j < taps; j++)
+        {
+            int sy = std::min(std::max(int(2 * y) + offset + j, 0), int(height) - 1);
+            rows[j] = source + size_t(sy) * rowSize;
+        }
+        mipWeightRows(simd, rows, weights, taps, &column[0], rowSize);
+
+        float *out = target + size_t(y) * targetWidth * channels;
+        GLubyte *outBytes = bytes + size_t(y) * targetWidth * channels;
+        for (GLuint x = 0; x < targetWidth; x++)
+        {
+            const size_t *texels = &taken[size_t(x) * taps];
+            float *texel = out + size_t(x) * channels;
+#if defined(__SSE2__)
+            if (channels == 4 && simd != MIP_SIMD_SCALAR)
+            {
+                __m128 sum = _mm_mul_ps(_mm_set1_ps(weights[0]), _mm_loadu_ps(&column[texels[0]]));
+                for (int i = 1; i < taps; i++)
+                    sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[i]), _mm_loadu_ps(&column[texels[i]])));
+                _mm_storeu_ps(texel, sum);
+                // Clamped and scaled to the table (or byte) index of every channel at once
+                sum = _mm_min_ps(_mm_max_ps(sum, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+                int index[4];
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(index),
+                                 _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(sum, scale4), _mm_set1_ps(0.5f))));
+                GLubyte *outTexel = outBytes + size_t(x) * 4;
+                for (int k = 0; k < 3; k++)
+                    outTexel[k] = srgb ? fromLinear[index[k]] : static_cast<GLubyte>(index[k]);
+                outTexel[3] = static_cast<GLubyte>(index[3]);
+                continue;
+            }
+#endif
+            for (int k = 0; k < channels; k++)
+            {
+                float sum = 0.0f;
+                for (int i = 0; i < taps; i++)
+                    sum += weights[i] * column[texels[i] + k];
+                texel[k] = sum;
+                outBytes[size_t(x) * channels + k] = encodeMipTexel(sum, srgb, isAlphaChannel(k, channels));
+            }
+        }
+    }
+}
+
+// The threads and instruction set of the image kernels that split their rows across cores
+// (MipGenerator, BlockCompressor)
+class RowWorkers
+{
+public:
+    unsigned threadCount() const { return threads; }
+
+    // Caps the instruction set, e.g. to compare against the scalar code
+    void limitSimd(MipSimd level) { simd = std::min(level, detectMipSimd()); }
+    MipSimd simdLevel() const { return simd; }
+
+protected:
+    // threadCount 0 uses every core
+    explicit RowWorkers(unsigned threadCount)
+        : threads(threadCount ? threadCount : std::max(1u, std::thread::hardware_concurrency())),
+          simd(detectMipSimd())
+    {
+    }
+
+    // Runs function(first, last) on slices of [0, rows), the calling thread takes the first one.
+    // minRowsPerThread: below it more threads cost more than they save
+    template <typename Function>
+    void forEachRows(GLuint rows, GLuint minRowsPerThread, Function function) const
+    {
+        GLuint count = std::min<GLuint>(threads, std::max<GLuint>(1, rows / minRowsPerThread));
+        std::vector<std::thread> workers;
+        for (GLuint t = 1; t < count; t++)
+            workers.push_back(std::thread(function, GLuint(size_t(rows) * t / count),
+                                          GLuint(size_t(rows) * (t + 1) / count)));
+        function(0, GLuint(rows / count));
+        for (size_t t = 0; t < workers.size(); t++)
+            workers[t].join();
+    }
+
+    unsigned threads;
+    MipSimd simd;
+};
+
+// Builds mip chains on the CPU instead of glGenerateMipmap, whose filter is up to the driver and
+// which is slow on software GL. Rows of every level are split across threads.
+//
+// The plain box filter on linear data runs on 8 bit integers with SSE2 or AVX2, whichever the CPU has.
+// sRGB images are averaged as linear light (alpha stays linear) so mips don't get darker, that and
+// the triangle filter work on floats, with SSE2 for the filtering and tables for the sRGB conversions.
+class MipGenerator : public RowWorkers
+{
+public:
+    // threadCount 0 uses every core
+    MipGenerator(unsigned threadCount = 0)
+        : RowWorkers(threadCount)
+    {
+    }
+
+    // Fills `mips` with every level below the base image down to 1x1: mips[0] is half its size.
+    // channels is 1 to 4; with 2 or 4 the last one is alpha. srgb: the color channels are sRGB encoded.
+    void generate(const GLubyte *pixels, GLuint width, GLuint height, int channels, bool srgb, MipFilter filter,
+                  std::vector<MipLevel> &mips) const
+    {
+        mips.clear();
+        size_t levelCount = 0;
+        for (GLuint w = width, h = height; w > 1 || h > 1; w = std::max(1u, w / 2), h = std::max(1u, h / 2))
+            levelCount++;
+        mips.resize(levelCount); // Up front, levels are read while the next one is built
+
+        bool floats = srgb || filter != MIP_FILTER_BOX;
+        std::vector<float> linear[2];
+        if (floats)
+        {
+            linear[0].resize(size_t(width) * height * channels);
+            forEachRows(height, MIP_ROWS_PER_THREAD, [&](GLuint first, GLuint last) {
+                mipDecodeRows(pixels, width, channels, srgb, &linear[0][0], first, last);
+            });
+        }
+
+        const GLubyte *source = pixels;
+        GLuint w = width, h = height;
+        for (size_t i = 0; i < levelCount; i++)
+        {
+            MipLevel &level = mips[i];
+            level.width = std::max(1u, w / 2);
+            level.height = std::max(1u, h / 2);
+            level.pixels.resize(size_t(level.width) * level.height * channels);
+            if (floats)
+            {
+                const float *from = &linear[i % 2][0];
+                std::vector<float> &to = linear[(i + 1) % 2];
+                to.resize(level.pixels.size());
+                forEachRows(level.height, MIP_ROWS_PER_THREAD, [&](GLuint first, GLuint last) {
+                    mipFilterRows(simd, filter, srgb, from, w, h, channels, &to[0], &level.pixels[0],
+                                  level.width, first, last);
+                });
+            }
+            else
+            {
+                forEachRows(level.height, MIP_ROWS_PER_THREAD, [&](GLuint first, GLuint last) {
+                    mipBoxRows(simd, source, w, h, channels, &level.pixels[0], level.width, first, last);
+                });
+            }
+            source = &level.pixels[0];
+            w = level.width;
+            h = level.height;
+        }
+    }
+
+    static const char *simdName(MipSimd level)
+    {
+        return level == MIP_SIMD_AVX2 ? "AVX2" : level == MIP_SIMD_SSE2 ? "SSE2" : "scalar";
+    }
+};
+
+// Builds a box filtered mip chain for an image that arrives one row at a time, e.g. from a streaming
+// decoder. Every level keeps at most two rows (as floats), so the image itself never has to be in
+// memory; each finished mip row is written to its place right away. With sRGB the bytes are the same
+// as MipGenerator::generate's; without, they can be a step off its integer box filter.
+class MipRowStream
+{
+public:
+    MipRowStream()
+        : simd(detectMipSimd())
+    {
+    }
+
+    // The base image is width x height x channels, its mips are written one after the other from `mips`.
+    // reversed: rows arrive from the last one to the first, e.g. when flipping a top-down image on load.
+    void begin(GLuint width, GLuint height, int channels, bool srgb, bool reversed, GLubyte *mips)
+    {
+        this->channels = channels;
+        this->srgb = srgb;
+        this->reversed = reversed;
+        levels.clear();
+        levels.push_back(Level(width, height, channels, NULL));
+        for (GLuint w = width, h = height; w > 1 || h > 1;)
+        {
+            w = std::max(1u, w / 2);
+            h = std::max(1u, h / 2);
+            levels.push_back(Level(w, h, channels, mips));
+            mips += size_t(w) * h * channels;
+        }
+    }
+
+    // The next row of the base image, in arrival order
+    void addRow(const GLubyte *row)
+    {
+        Level &base = levels[0];
+        mipDecodeRows(row, base.width, channels, srgb, window(base, base.pending), 0, 1);
+        received(0);
+    }
+
+private:
+    struct Level
+    {
+        Level(GLuint width, GLuint height, int channels, GLubyte *pixels)
+            : width(width), height(height), pixels(pixels), arrived(0), pending(0),
+              rows(size_t(2) * width * channels)
+        {
+        }
+
+        GLuint width, height;
+        GLubyte *pixels; // NULL for the base image, it isn't written here
+        GLuint arrived;  // Rows so far
+        GLuint pending;  // Of them, waiting in `rows` for the other row of their pair
+        std::vector<float> rows;
+    };
+
+    float *window(Level &level, GLuint row) const
+    {
+        return &level.rows[size_t(row) * level.width * channels];
+    }
+
+    // Level k got a row in its window: once it holds a pair (or the only row), the next level gets its row
+    void received(size_t k)
+    {
+        Level &level = levels[k];
+        level.arrived++;
+        level.pending++;
+        // The last row of an odd height has no pair and isn't used by the next level, as in generate().
+        // Arriving reversed, that is the first one.
+        if (reversed && level.height % 2 == 1 && level.height > 1 && level.arrived == 1)
+            level.pending = 0;
+        if (k + 1 == levels.size() || (level.pending < 2 && level.height > 1))
+            return;
+
+        Level &next = levels[k + 1];
+        GLuint y = reversed ? next.height - 1 - next.arrived : next.arrived;
+        mipFilterRows(simd, MIP_FILTER_BOX, srgb, window(level, 0), level.width, level.pending, channels,
+                      window(next, next.pending), next.pixels + size_t(y) * next.width * channels, next.width, 0, 1);
+        level.pending = 0;
+        received(k + 1);
+    }
+
+    std::vector<Level> levels;
+    int channels;
+    bool srgb;
+    bool reversed;
+    MipSimd simd;
+};
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef PIXEL_BUFFER_RING_H
+#define PIXEL_BUFFER_RING_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <vector>
+
+// What PixelBufferRing::acquire returns instead of a buffer index
+const int PIXEL_BUFFER_BUSY = -1;       // Every buffer is still in flight, try again later
+const int PIXEL_BUFFER_MAP_FAILED = -2; // The driver couldn't map a buffer that large, retrying won't help
+
+// A small ring of pixel unpack buffers for streaming texture uploads. Pixels are written into a
+// mapped buffer (from any thread), then glTexImage2D reads from the buffer instead of client memory
+// and returns without waiting for the copy. A fence marks when the GPU is done with a buffer so it
+// can be reused; buffers still in flight are skipped instead of waited on.
+class PixelBufferRing
+{
+public:
+    PixelBufferRing()
+        : next(0), frameBytes(0), lastFrameBytes(0), peakFrameBytes(0), totalBytes(0)
+    {
+    }
+
+    void init(size_t count)
+    {
+        slots.resize(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            glGenBuffers(1, &slots[i].buffer);
+            slots[i].capacity = 0;
+            slots[i].fence = 0;
+            slots[i].mapped = false;
+        }
+    }
+
+    void destroy()
+    {
+        for (size_t i = 0; i < slots.size(); i++)
+        {
+            if (slots[i].mapped)
+            {
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slots[i].buffer);
+                glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            }
+            if (slots[i].fence)
+                glDeleteSync(slots[i].fence);
+            glDeleteBuffers(1, &slots[i].buffer);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        slots.clear();
+    }
+
+    // Maps a free buffer of at least `bytes` for writing. Returns its index, PIXEL_BUFFER_BUSY or
+    // PIXEL_BUFFER_MAP_FAILED.
+    int acquire(size_t bytes, void *&memory)
+    {
+        for (size_t tries = 0; tries < slots.size(); tries++)
+        {
+            int index = static_cast<int>(next);
+            next = (next + 1) % slots.size();
+            if (!isFree(slots[index]))
+                continue;
+
+            Slot &slot = slots[index];
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+            if (slot.capacity < bytes)
+            {
+                glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+                slot.capacity = bytes;
+            }
+            // The GPU is done with the old contents, so invalidating never makes the driver wait
+            memory = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes,
+                                      GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            if (!memory)
+                return PIXEL_BUFFER_MAP_FAILED;
+            slot.mapped = true;
+            return index;
+        }
+        return PIXEL_BUFFER_BUSY;
+    }
+
+    // Unmaps the buffer and binds it as GL_PIXEL_UNPACK_BUFFER: pixel pointers are now offsets into it.
+    // False when the driver lost the contents while it was mapped (e.g. a mode switch); the buffer is
+    // unmapped anyway and still has to be released.
+    bool bind(int index)
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slots[index].buffer);
+        GLboolean intact = glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        slots[index].mapped = false;
+        return intact == GL_TRUE;
+    }
+
+    // Call after the uploads reading from the buffer were issued. The buffer is reused once they finish.
+    void release(int index, size_t bytes)
+    {
+        slots[index].fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        frameBytes += bytes;
+        totalBytes += bytes;
+    }
+
+    // Closes the upload statistics of the frame
+    void endFrame()
+    {
+        lastFrameBytes = frameBytes;
+        peakFrameBytes = std::max(peakFrameBytes, frameBytes);
+        frameBytes = 0;
+    }
+
+    // Bytes streamed to textures during the last frame, the most in any frame and since start
+    size_t lastFrameUploadBytes() const { return lastFrameBytes; }
+    size_t peakFrameUploadBytes() const { return peakFrameBytes; }
+    size_t totalUploadBytes() const { return totalBytes; }
+
+private:
+    struct Slot
+    {
+        GLuint buffer;
+        size_t capacity;
+        GLsync fence; // Set while uploads may still read from the buffer
+        bool mapped;
+    };
+
+    bool isFree(Slot &slot)
+    {
+        if (slot.mapped)
+            return false;
+        if (!slot.fence)
+            return true;
+        GLenum status = glClientWaitSync(slot.fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            return false;
+        glDeleteSync(slot.fence);
+        slot.fence = 0;
+        return true;
+    }
+
+    std::vector<Slot> slots;
+    size_t next;
+    size_t frameBytes;
+    size_t lastFrameBytes;
+    size_t peakFrameBytes;
+    size_t totalBytes;
+};
+
+#endif
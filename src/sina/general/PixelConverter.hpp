@@ -0,0 +1,319 @@
+#ifndef PIXEL_CONVERTER_H
+#define PIXEL_CONVERTER_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "MipGenerator.hpp"
+
+// Textures are uploaded as GL_RGBA / GL_UNSIGNED_BYTE (or GL_BGRA) into GL_RGBA8, the layout GPUs keep
+// texels in: a 1 to 3 channel image would make the driver expand every texel itself, often on a slow
+// path. convertPixels brings decoded images there and can change them on the way.
+enum PixelConversion
+{
+    PIXEL_CONVERT_NONE = 0,        // Only expanded to RGBA
+    PIXEL_CONVERT_OPAQUE = 1,      // Alpha set to 255, for images drawn without their alpha
+    PIXEL_CONVERT_LINEAR = 2,      // sRGB color decoded to linear
+    PIXEL_CONVERT_PREMULTIPLY = 4, // Color multiplied by alpha, for blending with GL_ONE, GL_ONE_MINUS_SRC_ALPHA
+    PIXEL_CONVERT_BGRA = 8         // Red and blue swapped, for GL_BGRA uploads
+};
+
+// The upload format of converted pixels
+inline GLenum pixelUploadFormat(unsigned conversion)
+{
+    return conversion & PIXEL_CONVERT_BGRA ? GL_BGRA : GL_RGBA;
+}
+
+// sRGB to linear, rounded to 8 bits
+struct LinearTable
+{
+    GLubyte values[256];
+
+    LinearTable()
+    {
+        for (int i = 0; i < 256; i++)
+            values[i] = static_cast<GLubyte>(srgbTables().toLinear[i] * 255.0f + 0.5f);
+    }
+};
+
+inline const LinearTable &linearTable()
+{
+    static const LinearTable table;
+    return table;
+}
+
+// Every step converts `count` texels from `i` on; the SIMD ones leave the rest to the scalar one
+
+inline void pixelExpandScalar(const GLubyte *source, int channels, GLubyte *target, size_t count, size_t i = 0)
+{
+    for (; i < count; i++)
+    {
+        const GLubyte *s = source + i * channels;
+        GLubyte *t = target + i * 4;
+        GLubyte alpha = channels == 4 ? s[3] : channels == 2 ? s[1] : 255;
+        t[0] = s[0];
+        t[1] = channels >= 3 ? s[1] : s[0];
+        t[2] = channels >= 3 ? s[2] : s[0];
+        t[3] = alpha;
+    }
+}
+
+// c * a / 255, rounded, without dividing
+inline GLubyte pixelScale(int c, int a)
+{
+    int t = c * a + 128;
+    return static_cast<GLubyte>((t + (t >> 8)) >> 8);
+}
+
+inline void pixelPremultiplyScalar(GLubyte *rgba, size_t count, size_t i = 0)
+{
+    for (; i < count; i++)
+    {
+        GLubyte *t = rgba + i * 4;
+        for (int k = 0; k < 3; k++)
+            t[k] = pixelScale(t[k], t[3]);
+    }
+}
+
+inline void pixelOpaqueScalar(GLubyte *rgba, size_t count, size_t i = 0)
+{
+    for (; i < count; i++)
+        rgba[i * 4 + 3] = 255;
+}
+
+inline void pixelSwapRedBlueScalar(GLubyte *rgba, size_t count, size_t i = 0)
+{
+    for (; i < count; i++)
+        std::swap(rgba[i * 4], rgba[i * 4 + 2]);
+}
+
+#if defined(__SSE2__)
+// Grey and grey + alpha widen with unpacks; RGB needs a byte shuffle, which is AVX2's below
+inline void pixelExpandSse2(const GLubyte *source, int channels, GLubyte *target, size_t count)
+{
+    size_t i = 0;
+    if (channels == 1)
+    {
+        const __m128i opaque = _mm_set1_epi8(static_cast<char>(0xFF));
+        for (; i + 16 <= count; i += 16)
+        {
+            __m128i grey = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+            __m128i gg[2] = { _mm_unpacklo_epi8(grey, grey), _mm_unpackhi_epi8(grey, grey) };
+            __m128i ga[2] = { _mm_unpacklo_epi8(grey, opaque), _mm_unpackhi_epi8(grey, opaque) };
+            for (int h = 0; h < 2; h++)
+            {
+                __m128i *out = reinterpret_cast<__m128i*>(target + (i + h * 8) * 4);
+                _mm_storeu_si128(out, _mm_unpacklo_epi16(gg[h], ga[h]));
+                _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(gg[h], ga[h]));
+            }
+        }
+    }
+    else if (channels == 2)
+    {
+        const __m128i low = _mm_set1_epi16(0x00FF);
+        for (; i + 8 <= count; i += 8)
+        {
+            // Each 16 bit lane is grey | alpha << 8, the texel is grey | grey << 8 then that lane
+            __m128i ga = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i * 2));
+            __m128i grey = _mm_and_si128(ga, low);
+            __m128i gg = _mm_or_si128(grey, _mm_slli_epi16(grey, 8));
+            __m128i *out = reinterpret_cast<__m128i*>(target + i * 4);
+            _mm_storeu_si128(out, _mm_unpacklo_epi16(gg, ga));
+            _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(gg, ga));
+        }
+    }
+    pixelExpandScalar(source, channels, target, count, i);
+}
+
+inline void pixelPremultiplySse2(GLubyte *rgba, size_t count)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i half = _mm_set1_epi16(128);
+    const __m128i alphaLanes = _mm_setr_epi16(0, 0, 0, -1, 0, 0, 0, -1);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i *p = reinterpret_cast<__m128i*>(rgba + i * 4);
+        __m128i texels = _mm_loadu_si128(p);
+        __m128i halves[2] = { _mm_unpacklo_epi8(texels, zero), _mm_unpackhi_epi8(texels, zero) };
+        for (int h = 0; h < 2; h++)
+        {
+            // Alpha copied to all four lanes of its texel, then c * a / 255 as in pixelScale
+            __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(halves[h], _MM_SHUFFLE(3, 3, 3, 3)),
+                                                _MM_SHUFFLE(3, 3, 3, 3));
+            __m128i t = _mm_add_epi16(_mm_mullo_epi16(halves[h], alpha), half);
+            t = _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+            halves[h] = _mm_or_si128(_mm_andnot_si128(alphaLanes, t), _mm_and_si128(alphaLanes, halves[h]));
+        }
+        _mm_storeu_si128(p, _mm_packus_epi16(halves[0], halves[1]));
+    }
+    pixelPremultiplyScalar(rgba, count, i);
+}
+
+inline void pixelOpaqueSse2(GLubyte *rgba, size_t count)
+{
+    const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000));
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i *p = reinterpret_cast<__m128i*>(rgba + i * 4);
+        _mm_storeu_si128(p, _mm_or_si128(_mm_loadu_si128(p), alpha));
+    }
+    pixelOpaqueScalar(rgba, count, i);
+}
+
+inline void pixelSwapRedBlueSse2(GLubyte *rgba, size_t count)
+{
+    const __m128i greenAlpha = _mm_set1_epi32(static_cast<int>(0xFF00FF00));
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        // Red and blue are the low bytes of the 16 bit lanes: swap those lanes in every texel
+        __m128i *p = reinterpret_cast<__m128i*>(rgba + i * 4);
+        __m128i texels = _mm_loadu_si128(p);
+        __m128i redBlue = _mm_andnot_si128(greenAlpha, texels);
+        redBlue = _mm_shufflehi_epi16(_mm_shufflelo_epi16(redBlue, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1));
+        _mm_storeu_si128(p, _mm_or_si128(_mm_and_si128(texels, greenAlpha), redBlue));
+    }
+    pixelSwapRedBlueScalar(rgba, count, i);
+}
+#endif
+
+#if defined(MIP_GENERATOR_AVX2)
+__attribute__((target("avx2")))
+inline void pixelExpandAvx2(const GLubyte *source, int channels, GLubyte *target, size_t count)
+{
+    size_t i = 0;
+    if (channels == 3)
+    {
+        // Four RGB texels (12 bytes) spread to RGBA in each 128 bit lane, alpha set by the or
+        const __m256i spread = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+                                                0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+        const __m256i alpha = _mm256_set1_epi32(static_cast<int>(0xFF000000));
+        // Each load reads 16 bytes for 12, stop while those stay inside the source
+        for (; (i + 8) * 3 + 4 <= count * 3; i += 8)
+        {
+            __m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i * 3));
+            __m128i second = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i * 3 + 12));
+            __m256i texels = _mm256_inserti128_si256(_mm256_castsi128_si256(first), second, 1);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(target + i * 4),
+                                _mm256_or_si256(_mm256_shuffle_epi8(texels, spread), alpha));
+        }
+        pixelExpandScalar(source, channels, target, count, i);
+        return;
+    }
+    pixelExpandSse2(source, channels, target, count);
+}
+
+__attribute__((target("avx2")))
+inline void pixelPremultiplyAvx2(GLubyte *rgba, size_t count)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i half = _mm256_set1_epi16(128);
+    const __m256i alphaLanes = _mm256_setr_epi16(0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        // Same as SSE2 on twice the texels; unpacking and packing stay within the 128 bit lanes
+        __m256i *p = reinterpret_cast<__m256i*>(rgba + i * 4);
+        __m256i texels = _mm256_loadu_si256(p);
+        __m256i halves[2] = { _mm256_unpacklo_epi8(texels, zero), _mm256_unpackhi_epi8(texels, zero) };
+        for (int h = 0; h < 2; h++)
+        {
+            __m256i alpha = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(halves[h], _MM_SHUFFLE(3, 3, 3, 3)),
+                                                   _MM_SHUFFLE(3, 3, 3, 3));
+            __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(halves[h], alpha), half);
+            t = _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+            halves[h] = _mm256_blendv_epi8(t, halves[h], alphaLanes);
+        }
+        _mm256_storeu_si256(p, _mm256_packus_epi16(halves[0], halves[1]));
+    }
+    pixelPremultiplyScalar(rgba, count, i);
+}
+
+__attribute__((target("avx2")))
+inline void pixelSwapRedBlueAvx2(GLubyte *rgba, size_t count)
+{
+    const __m256i swap = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+                                          2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i *p = reinterpret_cast<__m256i*>(rgba + i * 4);
+        _mm256_storeu_si256(p, _mm256_shuffle_epi8(_mm256_loadu_si256(p), swap));
+    }
+    pixelSwapRedBlueScalar(rgba, count, i);
+}
+#endif
+
+// Converts `count` texels of `channels` (1 grey, 2 grey and alpha, 3 RGB, 4 RGBA) to RGBA in `target`,
+// then applies `conversion` (PixelConversion flags) in the order they are listed in. target may be
+// source for RGBA. Linear decoding goes through a table, the other steps use the instruction set given.
+inline void convertPixels(MipSimd simd, const GLubyte *source, int channels, GLubyte *target, size_t count,
+                          unsigned conversion)
+{
+    if (channels == 4)
+    {
+        if (source != target)
+            std::memcpy(target, source, count * 4);
+    }
+#if defined(MIP_GENERATOR_AVX2)
+    else if (simd == MIP_SIMD_AVX2)
+        pixelExpandAvx2(source, channels, target, count);
+#endif
+#if defined(__SSE2__)
+    else if (simd != MIP_SIMD_SCALAR)
+        pixelExpandSse2(source, channels, target, count);
+#endif
+    else
+        pixelExpandScalar(source, channels, target, count);
+
+    if (conversion & PIXEL_CONVERT_OPAQUE)
+    {
+#if defined(__SSE2__)
+        if (simd != MIP_SIMD_SCALAR)
+            pixelOpaqueSse2(target, count);
+        else
+#endif
+            pixelOpaqueScalar(target, count);
+    }
+    if (conversion & PIXEL_CONVERT_LINEAR)
+    {
+        const GLubyte *linear = linearTable().values;
+        for (size_t i = 0; i < count; i++)
+            for (int k = 0; k < 3; k++)
+                target[i * 4 + k] = linear[target[i * 4 + k]];
+    }
+    if (conversion & PIXEL_CONVERT_PREMULTIPLY)
+    {
+#if defined(MIP_GENERATOR_AVX2)
+        if (simd == MIP_SIMD_AVX2)
+            pixelPremultiplyAvx2(target, count);
+        else
+#endif
+#if defined(__SSE2__)
+        if (simd != MIP_SIMD_SCALAR)
+            pixelPremultiplySse2(target, count);
+        else
+#endif
+            pixelPremultiplyScalar(target, count);
+    }
+    if (conversion & PIXEL_CONVERT_BGRA)
+    {
+#if defined(MIP_GENERATOR_AVX2)
+        if (simd == MIP_SIMD_AVX2)
+            pixelSwapRedBlueAvx2(target, count);
+        else
+#endif
+#if defined(__SSE2__)
+        if (simd != MIP_SIMD_SCALAR)
+            pixelSwapRedBlueSse2(target, count);
+        else
+#endif
+            pixelSwapRedBlueScalar(target, count);
+    }
+}
+
+#endif
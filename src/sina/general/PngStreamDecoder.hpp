@@ -0,0 +1,204 @@
+#ifndef PNG_STREAM_DECODER_H
+#define PNG_STREAM_DECODER_H
+
+#include <glad/glad.h>
+#include <libpng16/png.h>
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "MipGenerator.hpp"
+#include "PixelConverter.hpp"
+
+// Bytes of the file handed to libpng at a time
+const size_t PNG_STREAM_CHUNK_BYTES = 64 * 1024;
+
+// Decodes a PNG with libpng's progressive reader: the file is fed a chunk at a time and every row is
+// written straight to its place in the destination, e.g. a mapped pixel unpack buffer, as soon as
+// libpng has it; the mips are built from the rows on the way (see MipRowStream). Unlike stbi_load,
+// neither the whole file nor the whole image is ever in client memory, only a chunk of the file,
+// libpng's buffers and two rows per mip level.
+//
+// Decoding takes two steps so the destination can be made to measure: open() reads the header and
+// stops before the image data, decode() then writes the image. Every row is converted to RGBA on the
+// way (see convertPixels), from what stbi_load would give with no channel count asked for: palettes
+// become RGB (RGBA with transparency), 16 bit channels are cut to 8, grey stays grey.
+// Interlaced images are refused, their passes have to be combined in memory.
+class PngStreamDecoder
+{
+public:
+    PngStreamDecoder()
+        : file(NULL), png(NULL), info(NULL), width(0), height(0), channels(0), flip(false), haveInfo(false),
+          interlaced(false), rows(0), pixels(NULL), mips(false), conversion(PIXEL_CONVERT_NONE),
+          simd(detectMipSimd())
+    {
+    }
+
+    ~PngStreamDecoder()
+    {
+        close();
+    }
+
+    // Reads up to the image data. False when the file can't be read, isn't a PNG or is interlaced,
+    // another decoder has to take it then.
+    // flipVertically: rows are written bottom first, like with stbi_set_flip_vertically_on_load(true)
+    bool open(const std::string &path, bool flipVertically)
+    {
+        close();
+        flip = flipVertically;
+        file = std::fopen(path.c_str(), "rb");
+        if (!file)
+            return false;
+        png_byte signature[8];
+        if (std::fread(signature, 1, sizeof(signature), file) != sizeof(signature) ||
+            png_sig_cmp(signature, 0, sizeof(signature)) != 0)
+        {
+            close();
+            return false;
+        }
+        png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, onError, onWarning);
+        info = png ? png_create_info_struct(png) : NULL;
+        if (!info)
+        {
+            close();
+            return false;
+        }
+        if (setjmp(png_jmpbuf(png)))
+        {
+            close();
+            return false;
+        }
+        png_set_progressive_read_fn(png, this, onInfo, onRow, NULL);
+        chunk.resize(PNG_STREAM_CHUNK_BYTES);
+        png_process_data(png, info, signature, sizeof(signature));
+        while (!haveInfo && feed())
+        {
+        }
+        if (!haveInfo || interlaced)
+        {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    GLuint imageWidth() const { return width; }
+    GLuint imageHeight() const { return height; }
+
+    // Writes the image as RGBA to `target` (width * height * 4 bytes) and, unless mipTarget is NULL, its
+    // box filtered mips one after the other from there. `conversion` holds PixelConversion flags.
+    // Closes the file. False when the data is broken, the targets are then only partly written.
+    bool decode(GLubyte *target, GLubyte *mipTarget, bool srgb, unsigned conversion)
+    {
+        pixels = target;
+        mips = mipTarget != NULL;
+        this->conversion = conversion;
+        converted.resize(size_t(width) * 4);
+        if (mips)
+            mipStream.begin(width, height, 4, srgb, flip, mipTarget);
+        if (setjmp(png_jmpbuf(png)))
+        {
+            close();
+            return false;
+        }
+        // What open() read past the header first, libpng kept it
+        png_process_data(png, info, &chunk[0], 0);
+        while (rows < height && feed())
+        {
+        }
+        bool complete = rows == height;
+        close();
+        return complete;
+    }
+
+private:
+    PngStreamDecoder(const PngStreamDecoder &);
+    PngStreamDecoder &operator=(const PngStreamDecoder &);
+
+    // Hands the next chunk of the file to libpng, which calls back with the header and rows it completes
+    bool feed()
+    {
+        size_t read = std::fread(&chunk[0], 1, chunk.size(), file);
+        if (read == 0)
+            return false;
+        png_process_data(png, info, &chunk[0], read);
+        return true;
+    }
+
+    void close()
+    {
+        if (png)
+            png_destroy_read_struct(&png, info ? &info : NULL, NULL);
+        png = NULL;
+        info = NULL;
+        if (file)
+            std::fclose(file);
+        file = NULL;
+        std::vector<png_byte>().swap(chunk);
+        std::vector<GLubyte>().swap(converted);
+    }
+
+    static void onInfo(png_structp png, png_infop info)
+    {
+        PngStreamDecoder *self = static_cast<PngStreamDecoder*>(png_get_progressive_ptr(png));
+        png_set_expand(png);
+        png_set_strip_16(png);
+        png_read_update_info(png, info);
+        self->width = png_get_image_width(png, info);
+        self->height = png_get_image_height(png, info);
+        self->channels = png_get_channels(png, info);
+        self->interlaced = png_get_interlace_type(png, info) != PNG_INTERLACE_NONE;
+        self->haveInfo = true;
+        // Stops png_process_data here, the rest of the chunk is kept for decode()
+        png_process_data_pause(png, 1);
+    }
+
+    static void onRow(png_structp png, png_bytep row, png_uint_32 number, int)
+    {
+        PngStreamDecoder *self = static_cast<PngStreamDecoder*>(png_get_progressive_ptr(png));
+        if (!row)
+            return;
+        // Converted here, the destination may be write only memory that the mips can't read back
+        convertPixels(self->simd, row, self->channels, &self->converted[0], self->width, self->conversion);
+        size_t rowBytes = self->converted.size();
+        GLuint y = self->flip ? self->height - 1 - number : number;
+        std::memcpy(self->pixels + y * rowBytes, &self->converted[0], rowBytes);
+        if (self->mips)
+            self->mipStream.addRow(&self->converted[0]);
+        self->rows++;
+    }
+
+    static void onError(png_structp png, png_const_charp message)
+    {
+        std::cout << "PNG error: " << message << std::endl;
+        png_longjmp(png, 1);
+    }
+
+    // Like stb_image, warnings (mostly about color profiles) are ignored
+    static void onWarning(png_structp, png_const_charp)
+    {
+    }
+
+    FILE *file;
+    png_structp png;
+    png_infop info;
+    std::vector<png_byte> chunk;
+    GLuint width;
+    GLuint height;
+    int channels;
+    bool flip;
+    bool haveInfo;
+    bool interlaced;
+    GLuint rows; // Written so far
+    GLubyte *pixels;
+    bool mips;
+    unsigned conversion;
+    std::vector<GLubyte> converted; // The current row as RGBA
+    MipSimd simd;
+    MipRowStream mipStream;
+};
+
+#endif
@@ -0,0 +1,208 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <glad/glad.h>
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "AtlasCache.hpp"
+#include "GLExtensions.hpp"
+
+// Program binaries are core in GL 4.1 and ARB_get_program_binary, not in the GL 3.3 glad we build with
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+typedef void (APIENTRYP ProgramBinaryGetProc)(GLuint program, GLsizei bufSize, GLsizei *length,
+                                               GLenum *binaryFormat, void *binary);
+typedef void (APIENTRYP ProgramBinaryLoadProc)(GLuint program, GLenum binaryFormat, const void *binary,
+                                                GLsizei length);
+typedef void (APIENTRYP ProgramParameterProc)(GLuint program, GLenum pname, GLint value);
+
+// Bump whenever the layout of the file changes
+const uint32_t PROGRAM_CACHE_VERSION = 1;
+
+// On-disk layout: this header, then binaryLength bytes from glGetProgramBinary
+struct ProgramCacheHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint32_t binaryFormat;
+    uint32_t binaryLength;
+};
+
+// Keeps linked programs on disk so the next start hands the driver its own binary instead of compiling
+// GLSL. A program is found by a hash of its sources and of the driver's vendor, renderer and version
+// strings: a driver update misses and recompiles. The driver may still reject a binary it wrote (new
+// hardware, a driver that didn't bump its version string), that counts as a miss too.
+// One file per program in a directory, so permutations don't rewrite each other.
+class ProgramCache
+{
+public:
+    ProgramCache()
+        : enabled(false), driverHash(0), getProgramBinary(NULL), programBinary(NULL), programParameteri(NULL),
+          hits(0), misses(0), stores(0)
+    {
+    }
+
+    // Needs the context current. Stays disabled when the driver can't return binaries; Shader compiles as
+    // if there was no cache then.
+    // load: the same loader glad was initialized with, the entry points aren't in our glad
+    void init(GLADloadproc load, const std::string &cacheDirectory)
+    {
+        GLint major = 0;
+        GLint minor = 0;
+        glGetIntegerv(GL_MAJOR_VERSION, &major);
+        glGetIntegerv(GL_MINOR_VERSION, &minor);
+        GLint formats = 0;
+        if (major > 4 || (major == 4 && minor >= 1) || hasGLExtension("GL_ARB_get_program_binary"))
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        if (formats > 0)
+        {
+            getProgramBinary = reinterpret_cast<ProgramBinaryGetProc>(load("glGetProgramBinary"));
+            programBinary = reinterpret_cast<ProgramBinaryLoadProc>(load("glProgramBinary"));
+            programParameteri = reinterpret_cast<ProgramParameterProc>(load("glProgramParameteri"));
+        }
+        enabled = getProgramBinary && programBinary && programParameteri;
+        if (!enabled)
+            return;
+        directory = cacheDirectory;
+        mkdir(directory.c_str(), 0755);
+        const GLenum DRIVER_STRINGS[3] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+        driverHash = fnv1a64(NULL, 0);
+        for (int i = 0; i < 3; i++)
+        {
+            const char *value = reinterpret_cast<const char*>(glGetString(DRIVER_STRINGS[i]));
+            // The terminator keeps "ab" + "c" apart from "a" + "bc"
+            if (value)
+                driverHash = fnv1a64(value, std::strlen(value) + 1, driverHash);
+        }
+    }
+
+    bool isEnabled() const { return enabled; }
+
+    // Key of a program built from these sources on this driver
+    uint64_t key(const std::string &vertexSource, const std::string &fragmentSource) const
+    {
+        uint64_t hash = fnv1a64(vertexSource.c_str(), vertexSource.size() + 1, driverHash);
+        return fnv1a64(fragmentSource.c_str(), fragmentSource.size() + 1, hash);
+    }
+
+    // Gives `program` the cached binary for the key. True when it links; otherwise the program has to be
+    // built from source, as if it was freshly created.
+    bool load(GLuint program, uint64_t programKey)
+    {
+        if (!enabled)
+            return false;
+        std::vector<GLubyte> binary;
+        ProgramCacheHeader header;
+        FILE *file = std::fopen(path(programKey).c_str(), "rb");
+        bool read = file && std::fread(&header, sizeof(header), 1, file) == 1 &&
+                    std::memcmp(header.magic, "GLPB", 4) == 0 && header.version == PROGRAM_CACHE_VERSION &&
+                    header.key == programKey && header.binaryLength > 0;
+        if (read)
+        {
+            binary.resize(header.binaryLength);
+            read = std::fread(&binary[0], 1, binary.size(), file) == binary.size();
+        }
+        if (file)
+            std::fclose(file);
+        GLint linked = GL_FALSE;
+        if (read)
+        {
+            programBinary(program, header.binaryFormat, &binary[0], static_cast<GLsizei>(binary.size()));
+            glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        }
+        if (linked)
+            hits++;
+        else
+            misses++;
+        return linked == GL_TRUE;
+    }
+
+    // Call before glLinkProgram: some drivers only keep a binary around when asked to
+    void prepare(GLuint program)
+    {
+        if (enabled)
+            programParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
+    // Writes the binary of a linked program. Goes through a temporary file so a crash never leaves a
+    // truncated binary behind.
+    void store(GLuint program, uint64_t programKey)
+    {
+        if (!enabled)
+            return;
+        GLint length = 0;
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return;
+        std::vector<GLubyte> binary(length);
+        GLenum format = 0;
+        GLsizei written = 0;
+        getProgramBinary(program, length, &written, &format, &binary[0]);
+        if (written <= 0)
+            return;
+
+        ProgramCacheHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, "GLPB", 4);
+        header.version = PROGRAM_CACHE_VERSION;
+        header.key = programKey;
+        header.binaryFormat = format;
+        header.binaryLength = written;
+        std::string target = path(programKey);
+        std::string temporary = target + ".tmp";
+        FILE *file = std::fopen(temporary.c_str(), "wb");
+        if (!file)
+            return;
+        bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+                  std::fwrite(&binary[0], 1, written, file) == static_cast<size_t>(written);
+        ok = std::fclose(file) == 0 && ok;
+        if (!ok || std::rename(temporary.c_str(), target.c_str()) != 0)
+        {
+            std::remove(temporary.c_str());
+            return;
+        }
+        stores++;
+    }
+
+    void printStats() const
+    {
+        if (!enabled)
+        {
+            std::cout << "Program cache: not supported by the driver" << std::endl;
+            return;
+        }
+        std::cout << "Program cache: " << hits << " hits, " << misses << " misses, " << stores << " stored"
+                  << std::endl;
+    }
+
+private:
+    std::string path(uint64_t programKey) const
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "/%016llx.bin", static_cast<unsigned long long>(programKey));
+        return directory + name;
+    }
+
+    bool enabled;
+    std::string directory;
+    uint64_t driverHash;
+    ProgramBinaryGetProc getProgramBinary;
+    ProgramBinaryLoadProc programBinary;
+    ProgramParameterProc programParameteri;
+    size_t hits;
+    size_t misses;
+    size_t stores;
+};
+
+#endif
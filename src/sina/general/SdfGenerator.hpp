@@ -0,0 +1,194 @@
+#ifndef SDF_GENERATOR_H
+#define SDF_GENERATOR_H
+
+#include <glad/glad.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include FT_OUTLINE_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Distance field of one glyph. Rows go top to bottom like FreeType bitmaps, and left/top
+// are the bearing of the bitmap's top left corner (spread included).
+struct SdfBitmap
+{
+    int width;
+    int rows;
+    int left;
+    int top;
+    std::vector<GLubyte> pixels;
+};
+
+// Builds signed distance fields straight from FreeType outlines. The outline is flattened into
+// line segments; every texel stores its distance to the closest segment, positive inside the glyph.
+// 0.5 (128) is the edge and the field covers `spread` pixels on each side of it.
+class SdfGenerator
+{
+public:
+    SdfGenerator(int spread)
+        : spread(spread), penX(0.0f), penY(0.0f), startX(0.0f), startY(0.0f)
+    {
+    }
+
+    // Generates the field of the glyph loaded in the slot. Load it with FT_LOAD_NO_BITMAP so it has an outline.
+    bool generate(FT_GlyphSlot slot, SdfBitmap &out)
+    {
+        if (slot->format != FT_GLYPH_FORMAT_OUTLINE)
+            return false;
+        return generate(&slot->outline, out);
+    }
+
+    bool generate(FT_Outline *outline, SdfBitmap &out)
+    {
+        segments.clear();
+        FT_Outline_Funcs funcs;
+        funcs.move_to = moveTo;
+        funcs.line_to = lineTo;
+        funcs.conic_to = conicTo;
+        funcs.cubic_to = cubicTo;
+        funcs.shift = 0;
+        funcs.delta = 0;
+        if (FT_Outline_Decompose(outline, &funcs, this))
+            return false;
+        closeContour();
+
+        FT_BBox box;
+        FT_Outline_Get_CBox(outline, &box);
+        if (segments.empty() || box.xMax <= box.xMin || box.yMax <= box.yMin)
+        {
+            // Blank glyph (space): only the advance matters
+            out.width = out.rows = out.left = out.top = 0;
+            out.pixels.clear();
+            return true;
+        }
+        out.left = static_cast<int>(std::floor(box.xMin / 64.0f)) - spread;
+        out.top = static_cast<int>(std::ceil(box.yMax / 64.0f)) + spread;
+        out.width = static_cast<int>(std::ceil(box.xMax / 64.0f)) + spread - out.left;
+        out.rows = out.top - (static_cast<int>(std::floor(box.yMin / 64.0f)) - spread);
+        out.pixels.resize(out.width * out.rows);
+
+        for (int row = 0; row < out.rows; row++)
+        {
+            float py = out.top - row - 0.5f;
+            for (int col = 0; col < out.width; col++)
+            {
+                float px = out.left + col + 0.5f;
+                float distance = signedDistance(px, py);
+                float value = 0.5f + distance / (2.0f * spread);
+                value = std::min(std::max(value, 0.0f), 1.0f);
+                out.pixels[row * out.width + col] = static_cast<GLubyte>(value * 255.0f + 0.5f);
+            }
+        }
+        return true;
+    }
+
+private:
+    struct Segment
+    {
+        float x0, y0, x1, y1;
+    };
+
+    // Distance to the closest segment, positive inside (non-zero winding, like TrueType fills)
+    float signedDistance(float px, float py) const
+    {
+        float best = 1e30f;
+        int winding = 0;
+        for (size_t i = 0; i < segments.size(); i++)
+        {
+            const Segment &s = segments[i];
+            float dx = s.x1 - s.x0;
+            float dy = s.y1 - s.y0;
+            float lengthSq = dx * dx + dy * dy;
+            float t = lengthSq > 0.0f ? ((px - s.x0) * dx + (py - s.y0) * dy) / lengthSq : 0.0f;
+            t = std::min(std::max(t, 0.0f), 1.0f);
+            float ex = s.x0 + t * dx - px;
+            float ey = s.y0 + t * dy - py;
+            best = std::min(best, ex * ex + ey * ey);
+
+            // Winding of a ray going from the point towards +x
+            if ((s.y0 <= py) != (s.y1 <= py))
+            {
+                float crossX = s.x0 + (py - s.y0) * dx / dy;
+                if (crossX > px)
+                    winding += s.y1 > s.y0 ? 1 : -1;
+            }
+        }
+        float distance = std::sqrt(best);
+        return winding != 0 ? distance : -distance;
+    }
+
+    void addLine(float x, float y)
+    {
+        Segment s = { penX, penY, x, y };
+        if (s.x0 != s.x1 || s.y0 != s.y1)
+            segments.push_back(s);
+        penX = x;
+        penY = y;
+    }
+
+    void closeContour()
+    {
+        if (!segments.empty() && (penX != startX || penY != startY))
+            addLine(startX, startY);
+    }
+
+    // Curves are flattened into a fixed number of lines, plenty at the small sizes fields are built at
+    static const int CURVE_STEPS = 8;
+
+    static int moveTo(const FT_Vector *to, void *user)
+    {
+        SdfGenerator *self = static_cast<SdfGenerator*>(user);
+        self->closeContour();
+        self->penX = self->startX = to->x / 64.0f;
+        self->penY = self->startY = to->y / 64.0f;
+        return 0;
+    }
+
+    static int lineTo(const FT_Vector *to, void *user)
+    {
+        static_cast<SdfGenerator*>(user)->addLine(to->x / 64.0f, to->y / 64.0f);
+        return 0;
+    }
+
+    static int conicTo(const FT_Vector *control, const FT_Vector *to, void *user)
+    {
+        SdfGenerator *self = static_cast<SdfGenerator*>(user);
+        float x0 = self->penX, y0 = self->penY;
+        float cx = control->x / 64.0f, cy = control->y / 64.0f;
+        float x1 = to->x / 64.0f, y1 = to->y / 64.0f;
+        for (int i = 1; i <= CURVE_STEPS; i++)
+        {
+            float t = static_cast<float>(i) / CURVE_STEPS;
+            float u = 1.0f - t;
+            self->addLine(u * u * x0 + 2 * u * t * cx + t * t * x1,
+                          u * u * y0 + 2 * u * t * cy + t * t * y1);
+        }
+        return 0;
+    }
+
+    static int cubicTo(const FT_Vector *control1, const FT_Vector *control2, const FT_Vector *to, void *user)
+    {
+        SdfGenerator *self = static_cast<SdfGenerator*>(user);
+        float x0 = self->penX, y0 = self->penY;
+        float c1x = control1->x / 64.0f, c1y = control1->y / 64.0f;
+        float c2x = control2->x / 64.0f, c2y = control2->y / 64.0f;
+        float x1 = to->x / 64.0f, y1 = to->y / 64.0f;
+        for (int i = 1; i <= CURVE_STEPS; i++)
+        {
+            float t = static_cast<float>(i) / CURVE_STEPS;
+            float u = 1.0f - t;
+            self->addLine(u * u * u * x0 + 3 * u * u * t * c1x + 3 * u * t * t * c2x + t * t * t * x1,
+                          u * u * u * y0 + 3 * u * u * t * c1y + 3 * u * t * t * c2y + t * t * t * y1);
+        }
+        return 0;
+    }
+
+    int spread;
+    std::vector<Segment> segments;
+    float penX, penY;
+    float startX, startY;
+};
+
+#endif
@@ -0,0 +1,181 @@
+#ifndef SPRITE_ATLAS_H
+#define SPRITE_ATLAS_H
+
+#include <glad/glad.h>
+#include <stb_image.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "AtlasPacker.hpp"
+#include "PixelConverter.hpp"
+
+// Where a sprite ended up: the page texture and its rectangle in that texture's coordinates
+struct Sprite
+{
+    GLuint texture;
+    GLint page;
+    GLfloat rect[4]; // u, v, width, height; a sprite's own (s, t) maps to (u + s * width, v + t * height)
+};
+
+// Packs many small images into a few shared textures (pages), so sprites drawn one after the other
+// don't need a texture change in between as long as they are on the same page. Images are added by
+// name, packed by build() with the shelf packer (tallest first, which keeps shelves full) and looked
+// up by name afterwards.
+//
+// Every sprite is surrounded by a copy of its edge texels, so linear filtering at its border doesn't
+// pick up the neighbouring sprite. That covers the base level only: pages have no mipmaps.
+class SpriteAtlas
+{
+public:
+    SpriteAtlas(GLint pageSize = 1024)
+        : pageSize(pageSize)
+    {
+    }
+
+    // Decodes the image, converts it to RGBA with `conversion` (PixelConversion flags, but no BGRA:
+    // pages are uploaded as GL_RGBA) and queues it.
+    // Fails if it can't be read or doesn't fit on a page. Follows stbi_set_flip_vertically_on_load like
+    // every other texture.
+    bool add(const std::string &name, const std::string &imagePath, unsigned conversion = PIXEL_CONVERT_NONE)
+    {
+        Image image;
+        int channels;
+        image.name = name;
+        unsigned char *pixels = stbi_load(imagePath.c_str(), &image.width, &image.height, &channels, 0);
+        if (!pixels)
+        {
+            std::cout << "Failed to load texture " << imagePath << std::endl;
+            return false;
+        }
+        if (image.width + 2 * SPRITE_GUTTER > pageSize || image.height + 2 * SPRITE_GUTTER > pageSize)
+        {
+            std::cout << "Sprite " << imagePath << " is too big for a " << pageSize << " atlas page" << std::endl;
+            stbi_image_free(pixels);
+            return false;
+        }
+        size_t count = static_cast<size_t>(image.width) * image.height;
+        image.pixels.resize(count * 4);
+        convertPixels(detectMipSimd(), pixels, channels, &image.pixels[0], count, conversion);
+        stbi_image_free(pixels);
+        queued.push_back(std::move(image));
+        return true;
+    }
+
+    // Packs the queued images into as many pages as they need and uploads the pages
+    void build(GLint internalFormat, int min_filter, int mag_filter)
+    {
+        std::sort(queued.begin(), queued.end(), tallerFirst);
+        std::vector< std::vector<GLubyte> > pixels;
+        AtlasPacker packer(pageSize, pageSize, SPRITE_GUTTER);
+        for (size_t i = 0; i < queued.size(); i++)
+        {
+            const Image &image = queued[i];
+            int x = 0, y = 0;
+            if (pixels.empty() || !packer.pack(image.width, image.height, x, y))
+            {
+                // Page full (or none yet): the rest goes on a new one
+                pixels.push_back(std::vector<GLubyte>(static_cast<size_t>(pageSize) * pageSize * 4, 0));
+                packer.reset();
+                if (!packer.pack(image.width, image.height, x, y))
+                {
+                    // add() already refuses these, but the packer has the last word. The page stays for
+                    // the next sprite.
+                    std::cout << "Sprite " << image.name << " doesn't fit on an empty atlas page" << std::endl;
+                    std::vector<GLubyte>().swap(queued[i].pixels);
+                    continue;
+                }
+            }
+            copyWithGutter(image, &pixels.back()[0], x, y);
+            std::vector<GLubyte>().swap(queued[i].pixels);
+
+            Sprite sprite;
+            sprite.texture = 0; // Known once the pages are uploaded
+            sprite.page = static_cast<GLint>(pages.size() + pixels.size() - 1);
+            sprite.rect[0] = static_cast<GLfloat>(x) / pageSize;
+            sprite.rect[1] = static_cast<GLfloat>(y) / pageSize;
+            sprite.rect[2] = static_cast<GLfloat>(image.width) / pageSize;
+            sprite.rect[3] = static_cast<GLfloat>(image.height) / pageSize;
+            sprites[image.name] = sprite;
+        }
+        queued.clear();
+
+        for (size_t i = 0; i < pixels.size(); i++)
+        {
+            GLuint texture;
+            glGenTextures(1, &texture);
+            glBindTexture(GL_TEXTURE_2D, texture);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, min_filter);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, mag_filter);
+            glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, pageSize, pageSize, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                         &pixels[i][0]);
+            pages.push_back(texture);
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+        for (std::unordered_map<std::string, Sprite>::iterator it = sprites.begin(); it != sprites.end(); ++it)
+            it->second.texture = pages[it->second.page];
+    }
+
+    // NULL when no sprite of that name was built
+    const Sprite *find(const std::string &name) const
+    {
+        std::unordered_map<std::string, Sprite>::const_iterator it = sprites.find(name);
+        return it == sprites.end() ? NULL : &it->second;
+    }
+
+    size_t pageCount() const { return pages.size(); }
+
+    void destroy()
+    {
+        queued.clear();
+        if (!pages.empty())
+            glDeleteTextures(static_cast<GLsizei>(pages.size()), &pages[0]);
+        pages.clear();
+        sprites.clear();
+    }
+
+private:
+    // Texels between sprites: one copy of each neighbour's edge
+    static const int SPRITE_GUTTER = 2;
+
+    struct Image
+    {
+        std::string name;
+        int width;
+        int height;
+        std::vector<GLubyte> pixels; // RGBA
+    };
+
+    static bool tallerFirst(const Image &a, const Image &b)
+    {
+        return a.height > b.height;
+    }
+
+    // Copies the image to (x, y) and repeats its outermost rows and columns one texel further out
+    void copyWithGutter(const Image &image, GLubyte *page, int x, int y) const
+    {
+        size_t pageRow = static_cast<size_t>(pageSize) * 4;
+        size_t imageRow = static_cast<size_t>(image.width) * 4;
+        for (int row = -1; row <= image.height; row++)
+        {
+            int source = std::min(std::max(row, 0), image.height - 1);
+            GLubyte *target = page + (y + row) * pageRow + x * 4;
+            std::memcpy(target, &image.pixels[source * imageRow], imageRow);
+            std::memcpy(target - 4, target, 4);
+            std::memcpy(target + imageRow, target + imageRow - 4, 4);
+        }
+    }
+
+    GLint pageSize;
+    std::vector<Image> queued;
+    std::vector<GLuint> pages;
+    std::unordered_map<std::string, Sprite> sprites;
+};
+
+#endif
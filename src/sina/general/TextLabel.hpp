@@ -0,0 +1,162 @@
+#ifndef TEXT_LABEL_H
+#define TEXT_LABEL_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <string>
+#include <vector>
+
+#include "Shader.hpp"
+#include "GlyphTable.hpp"
+#include "TextBatch.hpp"
+#include "Utf8.hpp"
+
+// Lays out a UTF-8 string starting at (x, y) on the baseline and appends one GlyphInstance per visible glyph.
+// Returns the pen position after the last glyph.
+inline GLfloat layoutText(const GlyphTable &glyphs, const std::string &text, GLfloat x, GLfloat y, GLfloat scale,
+                          GLushort colorIndex, std::vector<GlyphInstance> &out)
+{
+    scale *= glyphs.getMetricScale();
+    GLfloat advanceScale = scale / 8.0f; // Advances are in 1/8 pixels
+    std::string::const_iterator c = text.begin();
+    while (c != text.end())
+    {
+        const Character &ch = glyphs.get(nextCodepoint(c, text.end()));
+
+        GLfloat xpos = x + ch.Bearing.x * scale;
+        GLfloat ypos = y - (ch.Size.y - ch.Bearing.y) * scale;
+
+        GLfloat w = ch.Size.x * scale;
+        GLfloat h = ch.Size.y * scale;
+        // Blank glyphs (spaces) only move the cursor
+        if (w > 0 && h > 0)
+        {
+            GlyphInstance glyph = {
+                { xpos, ypos },
+                glm::packHalf2x16(glm::vec2(w, h)),
+                { ch.AtlasRect[0], ch.AtlasRect[1], ch.AtlasRect[2], ch.AtlasRect[3] },
+                colorIndex,
+                0
+            };
+            out.push_back(glyph);
+        }
+        // Now advance cursors for next glyph
+        x += ch.Advance * advanceScale;
+    }
+    return x;
+}
+
+// Retained text: the layout is done once and the glyphs stay in their own GPU buffer.
+// Drawing an unchanged label is one uniform upload and one instanced draw, no layout and no upload.
+// The glyphs are only rebuilt when the string, scale or position changes, or when a non-ASCII glyph
+// the label uses may have been evicted from the glyph cache.
+class TextLabel
+{
+public:
+    TextLabel()
+        : vao(0), vbo(0), glyphCount(0), x(0.0f), y(0.0f), scale(1.0f), color(1.0f),
+          dirty(true), usesFallback(false), builtGeneration(0), paletteShader(0), paletteUniform(-1)
+    {
+    }
+
+    // Creates the label's VAO/VBO. The unit quad comes from the batch so every label shares it.
+    void init(const TextBatch &batch)
+    {
+        glGenVertexArrays(1, &vao);
+        glGenBuffers(1, &vbo);
+        glBindVertexArray(vao);
+        glBindBuffer(GL_ARRAY_BUFFER, batch.unitQuad());
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GLfloat), (void*)0);
+        glEnableVertexAttribArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        setGlyphInstanceAttribs(0, true);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindVertexArray(0);
+    }
+
+    void destroy()
+    {
+        glDeleteVertexArrays(1, &vao);
+        glDeleteBuffers(1, &vbo);
+        vao = vbo = 0;
+    }
+
+    // Cheap to call every frame: nothing happens unless something actually changed
+    void set(const std::string &newText, GLfloat newX, GLfloat newY, GLfloat newScale)
+    {
+        if (newText == text && newX == x && newY == y && newScale == scale)
+            return;
+        text = newText;
+        x = newX;
+        y = newY;
+        scale = newScale;
+        dirty = true;
+    }
+
+    // The color is a uniform, changing it never touches the glyphs
+    void setColor(const glm::vec3 &newColor)
+    {
+        color = newColor;
+    }
+
+    void draw(Shader &s, GLuint texture, const GlyphTable &glyphs)
+    {
+        if (dirty || (usesFallback && glyphs.fallbackGeneration() != builtGeneration))
+            rebuild(glyphs);
+        if (glyphCount == 0)
+            return;
+
+        s.use();
+        if (paletteShader != s.programId)
+        {
+            paletteShader = s.programId;
+            paletteUniform = s.uniform("textPalette");
+        }
+        // Every glyph of the label uses palette entry 0
+        s.setVec4Array(paletteUniform, glm::value_ptr(glm::vec4(color, 1.0f)), 1);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glBindVertexArray(vao);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, glyphCount);
+        glBindVertexArray(0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+private:
+    void rebuild(const GlyphTable &glyphs)
+    {
+        std::vector<GlyphInstance> instances;
+        instances.reserve(text.size());
+        layoutText(glyphs, text, x, y, scale, 0, instances);
+        // Only text past ASCII depends on the cache, everything else stays valid forever
+        usesFallback = false;
+        for (std::string::const_iterator c = text.begin(); c != text.end(); c++)
+            usesFallback |= static_cast<GLubyte>(*c) >= 0x80;
+        builtGeneration = glyphs.fallbackGeneration();
+        glyphCount = static_cast<GLsizei>(instances.size());
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        // Written rarely and drawn every frame
+        glBufferData(GL_ARRAY_BUFFER, sizeof(GlyphInstance) * instances.size(),
+                     instances.empty() ? NULL : &instances[0], GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        dirty = false;
+    }
+
+    GLuint vao;
+    GLuint vbo;
+    GLsizei glyphCount;
+    std::string text;
+    GLfloat x;
+    GLfloat y;
+    GLfloat scale;
+    glm::vec3 color;
+    bool dirty;
+    bool usesFallback;
+    GLuint builtGeneration;
+    GLuint paletteShader;
+    UniformHandle paletteUniform;
+};
+
+#endif
@@ -0,0 +1,179 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <glad/glad.h>
+
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "AsyncTextureLoader.hpp"
+#include "CookedTexture.hpp"
+#include "TextureResidency.hpp"
+
+// A texture handed out by TextureCache. The GL texture lives as long as any handle to it.
+struct CachedTexture
+{
+    GLuint texture;
+    size_t bytes; // Uploaded to it so far, 0 while the loader still works on it
+    bool streamed; // Its levels come and go with the residency manager, which counts its bytes
+    std::string key;
+};
+
+typedef std::shared_ptr<const CachedTexture> TextureHandle;
+
+// Loads every image once. Textures are keyed by path and every parameter of the upload, so asking
+// for the same image with the same sampling again returns the texture already loaded instead of
+// decoding and uploading a copy. The cache only keeps weak references: a texture is deleted when
+// the last handle to it is dropped.
+//
+// Images with a cooked version (see cookedTexturePath) are uploaded from it right away, or handed
+// to the residency manager when there is one. The others go through the async loader and show its
+// placeholder until they arrive.
+class TextureCache
+{
+public:
+    TextureCache(AsyncTextureLoader &loader)
+        : loader(loader), residency(NULL), resident(0), hits(0), misses(0)
+    {
+        loader.setDoneCallback(onLoaded, this);
+    }
+
+    // Cooked textures loaded from now on only get the mip levels they are drawn with
+    void setResidency(TextureResidency *manager)
+    {
+        residency = manager;
+    }
+
+    // Same parameters as AsyncTextureLoader::load. Call from the GL thread, like dropping a handle.
+    // A cooked version keeps the format it was cooked with.
+    TextureHandle load(const std::string &imagePath, int wrap_s, int wrap_t, int min_filter, int mag_filter,
+                       int internal_format, unsigned conversion)
+    {
+        std::ostringstream key;
+        key << imagePath << '|' << wrap_s << ',' << wrap_t << ',' << min_filter << ',' << mag_filter << ','
+            << internal_format << ',' << conversion;
+        std::unordered_map<std::string, std::weak_ptr<CachedTexture> >::iterator it = textures.find(key.str());
+        if (it != textures.end())
+        {
+            TextureHandle texture = it->second.lock();
+            if (texture)
+            {
+                hits++;
+                return texture;
+            }
+        }
+        misses++;
+
+        CachedTexture *created = new CachedTexture();
+        glGenTextures(1, &created->texture);
+        created->bytes = 0;
+        created->streamed = false;
+        std::string cookedPath = cookedTexturePath(imagePath);
+        // Only one of them opens the cooked file: what the residency manager can't use, a plain upload
+        // couldn't either
+        if (residency)
+            created->streamed = residency->add(created->texture, cookedPath.c_str(),
+                                               wrap_s, wrap_t, min_filter, mag_filter) > 0;
+        else
+            created->bytes = loadCookedTexture(created->texture, cookedPath.c_str(),
+                                               wrap_s, wrap_t, min_filter, mag_filter);
+        if (!created->streamed && created->bytes == 0)
+        {
+            loader.load(created->texture, imagePath, wrap_s, wrap_t, min_filter, mag_filter,
+                        internal_format, conversion);
+            loading[created->texture] = created;
+        }
+        created->key = key.str();
+        resident += created->bytes;
+        std::shared_ptr<CachedTexture> texture(created, Release(this));
+        textures[created->key] = texture;
+        return texture;
+    }
+
+    // Estimated from the bytes uploaded, the driver may pad formats like GL_RGB
+    size_t residentBytes() const { return resident + (residency ? residency->residentBytes() : 0); }
+
+    size_t textureCount() const { return textures.size(); }
+
+    // Call after the loader was destroyed and every handle dropped
+    void destroy()
+    {
+        for (std::unordered_set<GLuint>::iterator it = orphans.begin(); it != orphans.end(); ++it)
+            glDeleteTextures(1, &*it);
+        orphans.clear();
+        loading.clear();
+    }
+
+    void printStats() const
+    {
+        std::cout << "Texture cache: " << textures.size() << " textures, " << residentBytes() / 1024 << " KB resident, "
+                  << hits << " hits, " << misses << " misses" << std::endl;
+    }
+
+private:
+    // Deleter of the shared_ptr: runs when the last handle is dropped
+    struct Release
+    {
+        Release(TextureCache *cache)
+            : cache(cache)
+        {
+        }
+
+        void operator()(CachedTexture *texture) const
+        {
+            cache->release(texture);
+        }
+
+        TextureCache *cache;
+    };
+
+    void release(CachedTexture *texture)
+    {
+        std::unordered_map<std::string, std::weak_ptr<CachedTexture> >::iterator it = textures.find(texture->key);
+        if (it != textures.end() && it->second.expired())
+            textures.erase(it);
+        resident -= texture->bytes;
+        if (texture->streamed)
+            residency->remove(texture->texture);
+        if (loading.erase(texture->texture))
+        {
+            // The loader would still upload into it, and glBindTexture would bring a deleted name back:
+            // it is deleted once the loader is done with it
+            orphans.insert(texture->texture);
+        }
+        else
+            glDeleteTextures(1, &texture->texture);
+        delete texture;
+    }
+
+    static void onLoaded(void *user, GLuint texture, size_t bytes)
+    {
+        TextureCache *self = static_cast<TextureCache*>(user);
+        if (self->orphans.erase(texture))
+        {
+            glDeleteTextures(1, &texture);
+            return;
+        }
+        std::unordered_map<GLuint, CachedTexture*>::iterator it = self->loading.find(texture);
+        if (it == self->loading.end())
+            return; // Not one of ours
+        it->second->bytes = bytes;
+        self->resident += bytes;
+        self->loading.erase(it);
+    }
+
+    AsyncTextureLoader &loader;
+    TextureResidency *residency;
+    std::unordered_map<std::string, std::weak_ptr<CachedTexture> > textures;
+    std::unordered_map<GLuint, CachedTexture*> loading; // Waiting for the loader
+    std::unordered_set<GLuint> orphans; // Released while loading, deleted when the loader is done
+    size_t resident;
+    unsigned long hits;
+    unsigned long misses;
+};
+
+#endif
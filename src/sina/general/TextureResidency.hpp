@@ -0,0 +1,232 @@
+#ifndef TEXTURE_RESIDENCY_H
+#define TEXTURE_RESIDENCY_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "CookedTexture.hpp"
+
+// Levels up to this size are uploaded with the texture, finer ones only once it is drawn big enough
+const GLuint RESIDENCY_INITIAL_SIZE = 64;
+
+// Keeps only the mip levels each texture needs in texture memory, within a byte budget.
+// The renderer reports how big every texture is drawn; update() then streams in the finer levels
+// that size asks for (from the cooked file, which stays mapped) and, when the budget is exceeded,
+// drops the finest levels of the textures drawn least recently and smallest first.
+//
+// A texture's levels are always a complete chain from GL_TEXTURE_BASE_LEVEL down. Dropped levels are
+// respecified as 0x0, which gives their memory back, and the base level is moved past them.
+// Levels are only dropped under pressure: a texture that got smaller keeps its detail while it fits.
+class TextureResidency
+{
+public:
+    // budgetBytes: texture memory for every texture together,
+    // streamBytesPerFrame: how much update() uploads at most per frame (at least one level)
+    TextureResidency(size_t budgetBytes, size_t streamBytesPerFrame)
+        : budget(budgetBytes), streamLimit(streamBytesPerFrame), resident(0), frame(0),
+          streamedLevels(0), droppedLevels(0)
+    {
+    }
+
+    // Takes over a cooked texture: uploads its coarse levels now and the rest when needed.
+    // Returns the bytes uploaded, 0 when the file isn't there or isn't valid.
+    size_t add(GLuint texture, const char *path, int wrap_s, int wrap_t, int min_filter, int mag_filter)
+    {
+        std::unique_ptr<Entry> entry(new Entry());
+        if (!entry->cooked.open(path))
+            return 0;
+        entry->texture = texture;
+        entry->levelCount = entry->cooked.header().levelCount;
+        entry->base = initialBase(*entry);
+
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap_s);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap_t);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, min_filter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, mag_filter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, entry->base);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, entry->levelCount - 1);
+        size_t uploaded = 0;
+        for (GLint i = entry->base; i < entry->levelCount; i++)
+            uploaded += entry->cooked.upload(i);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        entry->bytes = uploaded;
+        resident += uploaded;
+        textures[texture] = std::move(entry);
+        return uploaded;
+    }
+
+    // Forgets a texture, before it is deleted
+    void remove(GLuint texture)
+    {
+        std::unordered_map<GLuint, std::unique_ptr<Entry> >::iterator it = textures.find(texture);
+        if (it == textures.end())
+            return;
+        resident -= it->second->bytes;
+        textures.erase(it);
+    }
+
+    // Called by the renderer for every draw: the texture covers about width x height pixels on screen
+    void reportDrawn(GLuint texture, GLfloat width, GLfloat height)
+    {
+        std::unordered_map<GLuint, std::unique_ptr<Entry> >::iterator it = textures.find(texture);
+        if (it == textures.end())
+            return;
+        Entry &entry = *it->second;
+        // The level the draw needs is the smallest one still at least as big as the drawn size on both axes
+        const CookedTextureLevel &full = entry.cooked.level(0);
+        GLfloat ratio = std::min(full.width / std::max(width, 1.0f), full.height / std::max(height, 1.0f));
+        GLint level = ratio <= 1.0f ? 0 : static_cast<GLint>(std::floor(std::log2(ratio)));
+        level = std::min(level, entry.levelCount - 1);
+        if (entry.drawnFrame != frame + 1)
+        {
+            // First draw since the last update
+            entry.drawnFrame = frame + 1;
+            entry.drawnSize = 0.0f;
+            entry.wanted = level;
+        }
+        entry.wanted = std::min(entry.wanted, level);
+        entry.drawnSize = std::max(entry.drawnSize, width * height);
+    }
+
+    // Once per frame: looks at the draws reported since the last call, drops levels to fit the budget,
+    // then streams finer levels in. Returns the bytes uploaded.
+    size_t update()
+    {
+        std::vector<Entry*> order;
+        for (std::unordered_map<GLuint, std::unique_ptr<Entry> >::iterator it = textures.begin();
+             it != textures.end(); ++it)
+            order.push_back(it->second.get());
+        // Most important first: drawn most recently, then biggest on screen
+        std::sort(order.begin(), order.end(), moreImportant);
+
+        // What every texture should end with: the levels it was drawn with lately (or what it has),
+        // made coarser from the least important end until everything fits
+        std::vector<GLint> target(order.size());
+        size_t total = 0;
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            target[i] = order[i]->drawnFrame == frame + 1 ? std::min(order[i]->wanted, order[i]->base)
+                                                          : order[i]->base;
+            total += chainBytes(*order[i], target[i]);
+        }
+        for (size_t i = order.size(); i-- > 0 && total > budget;)
+        {
+            while (total > budget && target[i] < initialBase(*order[i]))
+            {
+                total -= order[i]->cooked.residentSize(target[i]);
+                target[i]++;
+            }
+        }
+
+        // Drops first so their memory is free before anything new is uploaded
+        for (size_t i = 0; i < order.size(); i++)
+            while (order[i]->base < target[i])
+                dropLevel(*order[i]);
+        size_t streamed = 0;
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            while (order[i]->base > target[i] && (streamed == 0 || streamed < streamLimit))
+                streamed += streamLevel(*order[i]);
+        }
+        // Whatever didn't fit in this frame's stream is asked for again by the next frame's draws
+        glBindTexture(GL_TEXTURE_2D, 0);
+        frame++;
+        return streamed;
+    }
+
+    size_t residentBytes() const { return resident; }
+    size_t budgetBytes() const { return budget; }
+
+    void printStats() const
+    {
+        std::cout << "Texture residency: " << textures.size() << " textures, " << resident / 1024 << " of "
+                  << budget / 1024 << " KB, " << streamedLevels << " levels streamed in, "
+                  << droppedLevels << " dropped" << std::endl;
+    }
+
+private:
+    struct Entry
+    {
+        Entry()
+            : texture(0), levelCount(0), base(0), wanted(0), bytes(0), drawnFrame(0), drawnSize(0.0f)
+        {
+        }
+
+        MappedCookedTexture cooked;
+        GLuint texture;
+        GLint levelCount;
+        GLint base;   // Finest level in texture memory
+        GLint wanted; // Finest level its last frame's draws needed
+        size_t bytes;
+        unsigned long drawnFrame; // Last frame it was drawn in plus one, 0 if never
+        GLfloat drawnSize;        // Biggest area it was drawn with in that frame
+    };
+
+    static bool moreImportant(const Entry *a, const Entry *b)
+    {
+        if (a->drawnFrame != b->drawnFrame)
+            return a->drawnFrame > b->drawnFrame;
+        return a->drawnSize > b->drawnSize;
+    }
+
+    // The coarse levels every texture keeps, whatever the pressure
+    static GLint initialBase(const Entry &entry)
+    {
+        GLint base = entry.levelCount - 1;
+        while (base > 0 && std::max(entry.cooked.level(base - 1).width,
+                                    entry.cooked.level(base - 1).height) <= RESIDENCY_INITIAL_SIZE)
+            base--;
+        return base;
+    }
+
+    static size_t chainBytes(const Entry &entry, GLint base)
+    {
+        size_t bytes = 0;
+        for (GLint i = base; i < entry.levelCount; i++)
+            bytes += entry.cooked.residentSize(i);
+        return bytes;
+    }
+
+    size_t streamLevel(Entry &entry)
+    {
+        GLint level = entry.base - 1;
+        glBindTexture(GL_TEXTURE_2D, entry.texture);
+        size_t bytes = entry.cooked.upload(level);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+        entry.base = level;
+        entry.bytes += bytes;
+        resident += bytes;
+        streamedLevels++;
+        return bytes;
+    }
+
+    void dropLevel(Entry &entry)
+    {
+        GLint level = entry.base;
+        glBindTexture(GL_TEXTURE_2D, entry.texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level + 1);
+        entry.cooked.release(level);
+        entry.base = level + 1;
+        entry.bytes -= entry.cooked.residentSize(level);
+        resident -= entry.cooked.residentSize(level);
+        droppedLevels++;
+    }
+
+    size_t budget;
+    size_t streamLimit;
+    size_t resident;
+    unsigned long frame;
+    std::unordered_map<GLuint, std::unique_ptr<Entry> > textures;
+    unsigned long streamedLevels;
+    unsigned long droppedLevels;
+};
+
+#endif
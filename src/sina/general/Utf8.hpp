@@ -0,0 +1,57 @@
+#ifndef UTF8_H
+#define UTF8_H
+
+#include <glad/glad.h>
+
+#include <string>
+
+// Codepoint drawn in place of malformed UTF-8
+const GLuint REPLACEMENT_CHARACTER = 0xFFFD;
+
+// Decodes the UTF-8 sequence starting at `it`, moves `it` past it and returns its codepoint.
+// ASCII takes a single compare. Malformed, overlong or truncated sequences decode to
+// REPLACEMENT_CHARACTER and only skip their first byte, so the next valid character still shows.
+inline GLuint nextCodepoint(std::string::const_iterator &it, std::string::const_iterator end)
+{
+    GLubyte lead = static_cast<GLubyte>(*it++);
+    if (lead < 0x80)
+        return lead;
+
+    int length;
+    GLuint codepoint;
+    GLuint minimum;
+    if ((lead & 0xE0) == 0xC0)
+    {
+        length = 1;
+        codepoint = lead & 0x1F;
+        minimum = 0x80;
+    }
+    else if ((lead & 0xF0) == 0xE0)
+    {
+        length = 2;
+        codepoint = lead & 0x0F;
+        minimum = 0x800;
+    }
+    else if ((lead & 0xF8) == 0xF0)
+    {
+        length = 3;
+        codepoint = lead & 0x07;
+        minimum = 0x10000;
+    }
+    else
+        return REPLACEMENT_CHARACTER;
+
+    std::string::const_iterator next = it;
+    for (int i = 0; i < length; i++, next++)
+    {
+        if (next == end || (static_cast<GLubyte>(*next) & 0xC0) != 0x80)
+            return REPLACEMENT_CHARACTER;
+        codepoint = (codepoint << 6) | (static_cast<GLubyte>(*next) & 0x3F);
+    }
+    if (codepoint < minimum || codepoint > 0x10FFFF || (codepoint >= 0xD800 && codepoint <= 0xDFFF))
+        return REPLACEMENT_CHARACTER;
+    it = next;
+    return codepoint;
+}
+
+#endif
@@ -1,5 +1,6 @@
 #include <iostream>
-#include <map>
+#include <algorithm>
+#include <vector>
 #include <string>
 #include <glad/glad.h>
 //#define GLEW_STATIC
@@ -13,39 +14,87 @@
 #include <stb_image.h>
 
 #include "Shader.hpp"
+#include "ProgramCache.hpp"
+#include "ShaderCompiler.hpp"
+#include "FrameGlobals.hpp"
+#include "EmbeddedShaders.hpp" // Generated from src/sina/GLSL at build time
+#include "AtlasPacker.hpp"
+#include "TextBatch.hpp"
+#include "GlyphTable.hpp"
+#include "TextLabel.hpp"
+#include "SdfGenerator.hpp"
+#include "GlyphCache.hpp"
+#include "AtlasCache.hpp"
+#include "FontManager.hpp"
+#include "AsyncTextureLoader.hpp"
+#include "CookedTexture.hpp"
+#include "MipGenerator.hpp"
+#include "SpriteAtlas.hpp"
+#include "TextureCache.hpp"
 
 #define ERR_RTN -1
+//#define BENCHMARK_MIPMAPS // Times the CPU mip generator against glGenerateMipmap at startup
 
 // settings
 const GLuint WIDTH = 800;
 const GLuint HEIGHT = 600;
 
+// Text settings. Text scales are relative to FONT_SIZE.
+const char *FONT_PATH = "../../src/sina/fonts/open-sans/OpenSans-Regular.ttf";
+// With SDF_TEXT the glyphs are signed distance fields built at SDF_FONT_SIZE: one small atlas
+// stays sharp at every scale. Without it FreeType rasterizes bitmaps at FONT_SIZE.
+const bool SDF_TEXT = true;
+const GLuint FONT_SIZE = 48;
+const GLuint SDF_FONT_SIZE = 32;
+const GLint SDF_SPREAD = 4; // Pixels (at SDF_FONT_SIZE) covered by the distance field on each side of the edge
+const unsigned GLYPH_THREADS = 0; // Threads rasterizing the glyphs at startup, 0 uses every core
+const GLint GLYPH_ATLAS_SIZE = 1024; // ASCII is packed at the top, the rest is a cache of glyphs rasterized on first use
+const char *ATLAS_CACHE_PATH = "font_atlas.cache"; // Baked ASCII atlas, reused by the next start when nothing changed
+const char *PROGRAM_CACHE_DIR = "shader_cache"; // Linked shader programs, reused by the next start on the same driver
+// Budget of the FreeType cache behind the font manager: open faces, open sizes and bytes of cached glyphs
+const FT_UInt FONT_CACHE_MAX_FACES = 4;
+const FT_UInt FONT_CACHE_MAX_SIZES = 8;
+const FT_ULong FONT_CACHE_MAX_BYTES = 1024 * 1024;
+
+// Texture settings. Images are decoded on worker threads and uploaded by the render loop,
+// which spends at most TEXTURE_UPLOAD_BUDGET_MS per frame on it.
+const unsigned TEXTURE_DECODE_THREADS = 2;
+const double TEXTURE_UPLOAD_BUDGET_MS = 2.0;
+const size_t TEXTURE_UPLOAD_BUFFERS = 3; // Pixel unpack buffers the uploads stream through
+const GLint SPRITE_PAGE_SIZE = 1024; // Sprites are packed into pages of this size
+// Cooked textures only keep the mip levels they are drawn with, all of them within TEXTURE_BUDGET_BYTES.
+// Finer levels are streamed in as needed, at most TEXTURE_STREAM_BYTES_PER_FRAME per frame.
+const size_t TEXTURE_BUDGET_BYTES = 64 * 1024 * 1024;
+const size_t TEXTURE_STREAM_BYTES_PER_FRAME = 1024 * 1024;
+
 // Helper function signatures
 void framebuffer_size_callback(GLFWwindow *window, int width, int height);
 void processInput(GLFWwindow *window);
-void fillCharacterMap(FT_Face &face);
-void fillTexture(GLuint &texture, const GLchar* imagePath,
-                 int wrap_s, int wrap_t, int min_filter, int mag_filter,
-                 int output_format, int input_format, int datatype_format);
-void RenderBox(Shader &s, GLFWwindow *window, GLint player);
-void RenderText(Shader &s, std::string text, GLfloat x, GLfloat y, GLfloat scale, glm::vec3 color);
+GLushort texelToUnorm(GLint texel, GLint size);
+void fillCharacterMap(GlyphCache &cache, const char *fontPath, FT_UInt pixelSize);
+void flushTextBatch(void *batch);
+void setupObjectShader(Shader &s);
+void benchmarkMipmaps(const char *imagePath);
+void RenderBox(Shader &s, GLFWwindow *window, GLint player, const Sprite &sprite);
+void RenderText(Shader &s, const std::string &text, GLfloat x, GLfloat y, GLfloat scale, glm::vec3 color);
 
 // Global variables
 std::string VertexBufferStr;
 std::string FragmentBufferStr;
 
-struct Character {
-    GLuint     TextureID;  // ID handle of the glyph texture
-    glm::ivec2 Size;       // Size of glyph
-    glm::ivec2 Bearing;    // Offset from baseline to left/top of glyph
-    GLuint     Advance;    // Offset to advance to next glyph
-};
-
-std::map<GLchar, Character> Characters;
+GlyphTable Characters; // Glyph metrics, indexed directly by codepoint
+FontManager fonts; // Every font file and size, opened on demand and kept in FreeType's cache
+GlyphCache glyphCache(SDF_SPREAD); // Single texture holding every glyph of the font, non-ASCII ones loaded lazily
+TextBatch textBatch; // Collects all the text of a frame, drawn at once before the swap
+FrameGlobals frameGlobals; // Projection, viewport and time in one uniform buffer read by every shader
 GLuint VAOs[3];
 GLuint VBOs[3];
 GLuint EBO;
-GLuint textures[2];
+AsyncTextureLoader textureLoader; // Fills textures in the background, they show a placeholder until then
+TextureCache textureCache(textureLoader); // Every image loaded once, shared by whoever asks for it
+TextureResidency textureResidency(TEXTURE_BUDGET_BYTES, TEXTURE_STREAM_BYTES_PER_FRAME);
+SpriteAtlas spriteAtlas(SPRITE_PAGE_SIZE); // Small images share a few textures, looked up by name
+UniformHandle spriteRectUniform = -1; // Of object_vfShader, RenderBox sets it every draw
 
 GLfloat ctr_y1 = 0.0f;
 GLfloat ctr_y2 = 0.0f;
@@ -91,43 +140,56 @@ int main()
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     
     // Setup our shaders
-    Shader vfShader("../../src/sina/GLSL/vertex.glsl", "../../src/sina/GLSL/fragment.glsl");
-    Shader object_vfShader("../../src/sina/GLSL/vertex_object.glsl", "../../src/sina/GLSL/fragment_object.glsl");
-    
-    // Set up the projection as orthographic. (text doesn't need perspective)
-    glm::mat4 projection = glm::ortho(0.0f, static_cast<GLfloat>(WIDTH), 0.0f, static_cast<GLfloat>(HEIGHT));
-    vfShader.use();
-    glUniformMatrix4fv(glGetUniformLocation(vfShader.programId, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+    // They are only submitted here, the driver builds them while the fonts and textures load below
+    ProgramCache programCache;
+    programCache.init((GLADloadproc)glfwGetProcAddress, PROGRAM_CACHE_DIR);
+    ShaderCompiler shaderCompiler;
+    shaderCompiler.init((GLADloadproc)glfwGetProcAddress);
+    Shader vfShader(GLSL_TEXT_VERTEX, SDF_TEXT ? GLSL_TEXT_FRAGMENT_SDF : GLSL_TEXT_FRAGMENT, &programCache, true);
+    Shader object_vfShader(GLSL_OBJECT_VERTEX, GLSL_OBJECT_FRAGMENT, &programCache, true);
+    shaderCompiler.add(vfShader);
+    shaderCompiler.add(object_vfShader, setupObjectShader);
     
     //// Font creation ////
     FT_Library ft;
     if (FT_Init_FreeType(&ft)) // Intialize
         std::cout << "ERROR::FREETYPE: Could not init FreeType Library" << std::endl;
     
-    FT_Face face;
-    if (FT_New_Face(ft, "../../src/sina/fonts/open-sans/OpenSans-Regular.ttf", 0, &face)) // Load the font
-        std::cout << "ERROR::FREETYPE: Failed to load font" << std::endl;
+    // Faces are opened by the font manager when first needed and stay open while they are in use
+    fonts.init(ft, FONT_CACHE_MAX_FACES, FONT_CACHE_MAX_SIZES, FONT_CACHE_MAX_BYTES);
+    FontId regularFont = fonts.addFont(FONT_PATH);
     
-    // Sets the font's width and height parameters.
-    // Setting the width to 0 lets the face dynamically calculate the width based on the given height.
-    FT_Set_Pixel_Sizes(face, 0, 48);
+    // Glyphs are rasterized at this height, the width follows from it
+    GLuint glyphSize = SDF_TEXT ? SDF_FONT_SIZE : FONT_SIZE;
+    Characters.setMetricScale(FONT_SIZE / static_cast<GLfloat>(glyphSize));
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // Disable byte-alignment restriction
     
-    fillCharacterMap(face);
-    
-    FT_Done_Face(face);
-    FT_Done_FreeType(ft);
+    // Glyphs past ASCII are rasterized the first time they are drawn
+    glyphCache.init(fonts, regularFont, glyphSize, SDF_TEXT, GLYPH_ATLAS_SIZE);
+    fillCharacterMap(glyphCache, fonts.path(regularFont), glyphSize);
+    Characters.setFallback(&glyphCache);
+    glyphCache.setFlushCallback(flushTextBatch, &textBatch);
     ///////////////////////
     
     //// READ+GEN Textures ////
-    glGenTextures(2, textures);
+    // Cooked textures (built by the cookTextures target) start with their coarse mip levels, the finer
+    // ones are streamed in by textureResidency.update() once they are drawn big enough to need them.
+    // Without them the images are decoded in the background and uploaded by textureLoader.update().
     stbi_set_flip_vertically_on_load(true);
-    fillTexture(textures[0], "../../assets/brick_wall.jpg",
-                GL_REPEAT, GL_REPEAT, GL_LINEAR, GL_LINEAR,
-                GL_RGB, GL_RGB, GL_UNSIGNED_BYTE);
-    fillTexture(textures[1], "../../assets/awesomeface.png",
-                GL_REPEAT, GL_REPEAT, GL_LINEAR, GL_LINEAR,
-                GL_RGB, GL_RGBA, GL_UNSIGNED_BYTE);
+    textureLoader.start(TEXTURE_DECODE_THREADS, TEXTURE_UPLOAD_BUFFERS, true);
+    textureCache.setResidency(&textureResidency);
+    TextureHandle wallTexture = textureCache.load("../../assets/brick_wall.jpg",
+                                                  GL_REPEAT, GL_REPEAT, GL_LINEAR, GL_LINEAR,
+                                                  GL_RGBA8, PIXEL_CONVERT_NONE);
+    // Sprites are decoded right away, they are small. The face has always been drawn without its alpha.
+    spriteAtlas.add("awesomeface", "../../assets/awesomeface.png", PIXEL_CONVERT_OPAQUE);
+    spriteAtlas.build(GL_RGBA8, GL_LINEAR, GL_LINEAR);
+    const Sprite *faceSprite = spriteAtlas.find("awesomeface");
+    Sprite noSprite = { 0, 0, { 0.0f, 0.0f, 1.0f, 1.0f } }; // Draws nothing from the atlas
+    const Sprite &boxSprite = faceSprite ? *faceSprite : noSprite;
+#ifdef BENCHMARK_MIPMAPS
+    benchmarkMipmaps("../../assets/brick_wall.jpg");
+#endif
     ///////////////////////////
     
     unsigned int indices[] = {  // note that we start from 0!
@@ -139,23 +201,9 @@ int main()
     glGenVertexArrays(3, VAOs);
     glGenBuffers(3, VBOs);
     glGenBuffers(1, &EBO);
-    // bind Vertex Array Object
-    glBindVertexArray(VAOs[0]);
-    
-    glBindBuffer(GL_ARRAY_BUFFER, VBOs[0]);
-    // Either static, dynamic or stream draw. Static: less likely to change.
-    // Dynamic: likely to change. Stream: will change on every frame.
-    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * 6 * 4, NULL, GL_DYNAMIC_DRAW);
-    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), 0);
-    glEnableVertexAttribArray(0);
-    // note that this is allowed, the call to glVertexAttribPointer registered VBO as the vertex attribute's bound vertex
-    // buffer object so afterwards we can safely unbind
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    // You can unbind the VAO afterwards so other VAO calls won't accidentally modify this VAO, but this rarely happens.
-    // Modifying other
-    // VAOs requires a call to glBindVertexArray anyways so we generally don't unbind VAOs (nor VBOs) when it's not directly
-    // necessary.
-    glBindVertexArray(0);
+    // The text VAO/VBO are handed to the batcher which owns their vertex layout.
+    // The VBO holds one GlyphInstance per glyph, orphaned and refilled every frame (GL_STREAM_DRAW).
+    textBatch.init(VAOs[0], VBOs[0]);
     
     glBindVertexArray(VAOs[1]);
     glBindBuffer(GL_ARRAY_BUFFER, VBOs[1]);
@@ -198,14 +246,43 @@ int main()
     // To show out shape in WireFrame mode.
     //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
     
-    object_vfShader.use(); // don't forget to activate the shader before setting uniforms!
-    object_vfShader.setInt("texture1", 0);
-    object_vfShader.setInt("texture2", 1);
+    // Text that doesn't change is laid out once and stays on the GPU, drawing it costs a single draw call.
+    // Use RenderText for text that changes from frame to frame.
+    TextLabel titleLabel, subtitleLabel, scoreLabel;
+    titleLabel.init(textBatch);
+    titleLabel.set("OpenGL Tutorial", 8.0f, 570.0f, 0.5f);
+    subtitleLabel.init(textBatch);
+    subtitleLabel.set("PangPong", 8.0f, 550.0f, 0.25f);
+    scoreLabel.init(textBatch);
+    scoreLabel.set("0 : 0", 300.0f, 520.0f, 2.0f);
+    
+    // The glyph cache can flush queued text at any time, so the text shader is needed from the first frame.
+    // The boxes are left out until theirs is ready.
+    shaderCompiler.finish(vfShader);
+    shaderCompiler.poll();
+    programCache.printStats();
+    
+    // Set up the projection as orthographic. (text doesn't need perspective)
+    glm::mat4 projection = glm::ortho(0.0f, static_cast<GLfloat>(WIDTH), 0.0f, static_cast<GLfloat>(HEIGHT));
+    frameGlobals.init();
+    double firstFrame = glfwGetTime();
+    double lastFrame = firstFrame;
     
     // Rendering/Game loop
     while(!glfwWindowShouldClose(window))
     {
         processInput(window); // Check if window needs to be closed
+        glyphCache.beginFrame();
+        textureLoader.update(TEXTURE_UPLOAD_BUDGET_MS);
+        textureResidency.update(); // For the sizes textures were drawn with last frame
+        shaderCompiler.poll();
+        // Written once here for every shader
+        int framebufferWidth, framebufferHeight;
+        glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+        double now = glfwGetTime();
+        frameGlobals.update(projection, framebufferWidth, framebufferHeight, static_cast<GLfloat>(now - firstFrame),
+                            static_cast<GLfloat>(now - lastFrame));
+        lastFrame = now;
         
         // Actual rendering code
         glClearColor(0.0f, 0.0f, 0.0f, 1.0f); // State-setting function
@@ -213,11 +290,23 @@ int main()
         
         // ----------------- // ----------------- //
         // What we like to draw goes here:
-        RenderBox(object_vfShader, window, 1);
-        RenderBox(object_vfShader, window, 2);
-        RenderText(vfShader, "OpenGL Tutorial", 8.0f, 570.0f, 0.5f, glm::vec3(1.0, 1.0f, 1.0f));
-        RenderText(vfShader, "PangPong", 8.0f, 550.0f, 0.25f, glm::vec3(1.0, 1.0f, 1.0f));
-        RenderText(vfShader, "0 : 0", 300.0f, 520.0f, 2.0f, glm::vec3(1.0, 1.0f, 1.0f));
+        if (object_vfShader.isReady())
+        {
+            // The boxes share the wall texture and their sprite's atlas page: bound once for both
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, wallTexture->texture);
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D, boxSprite.texture);
+            glActiveTexture(GL_TEXTURE0);
+            // Both boxes are 2 * off_x by 2 * off_y in normalized device coordinates
+            textureResidency.reportDrawn(wallTexture->texture, off_x * framebufferWidth, off_y * framebufferHeight);
+            RenderBox(object_vfShader, window, 1, boxSprite);
+            RenderBox(object_vfShader, window, 2, boxSprite);
+        }
+        titleLabel.draw(vfShader, glyphCache.texture(), Characters);
+        subtitleLabel.draw(vfShader, glyphCache.texture(), Characters);
+        scoreLabel.draw(vfShader, glyphCache.texture(), Characters);
+        textBatch.flush(); // RenderText calls go out in one upload and one instanced draw per font
         // ----------------- // ----------------- //
         
         glfwSwapBuffers(window); // Related to the screen double buffer. Need to swap the front with the back buffer
@@ -228,7 +317,27 @@ int main()
     glDeleteVertexArrays(3, VAOs);
     glDeleteBuffers(3, VBOs);
     glDeleteBuffers(1, &EBO);
-    glDeleteTextures(2, textures);
+    glyphCache.printStats();
+    glyphCache.destroy();
+    fonts.printStats();
+    fonts.destroy();
+    FT_Done_FreeType(ft);
+    textBatch.destroy();
+    titleLabel.destroy();
+    subtitleLabel.destroy();
+    scoreLabel.destroy();
+    std::cout << "Texture uploads: " << textureLoader.totalUploadBytes() / 1024 << " KB streamed, peak "
+              << textureLoader.peakFrameUploadBytes() / 1024 << " KB in one frame" << std::endl;
+    textureCache.printStats();
+    textureResidency.printStats();
+    frameGlobals.printStats();
+    frameGlobals.destroy();
+    vfShader.printStats("text");
+    object_vfShader.printStats("objects");
+    wallTexture.reset();
+    textureLoader.destroy();
+    textureCache.destroy();
+    spriteAtlas.destroy();
     
     glfwTerminate(); // Clean GLFW properly
     return 0;
@@ -257,80 +366,171 @@ void processInput(GLFWwindow *window)
         ctr_y2 -= 0.02f;
 }
 
-void fillCharacterMap(FT_Face &face)
+GLushort texelToUnorm(GLint texel, GLint size)
+{
+    return static_cast<GLushort>((texel * 65535 + size / 2) / size);
+}
+
+void fillCharacterMap(GlyphCache &cache, const char *fontPath, FT_UInt pixelSize)
 {
-    for (GLubyte c = 0; c < 128; c++)
+    // All glyphs live in one atlas so text only ever samples from a single texture.
+    // ASCII is packed tightly into its top rows once; the cache hands out the space below on demand.
+    const int ATLAS_SIZE = cache.atlasSize();
+    double startTime = glfwGetTime();
+    std::vector<GLuint> codepoints;
+    for (GLuint c = 0; c < 128; c++)
+        codepoints.push_back(c);
+    
+    // A previous run may have baked this exact atlas already: map it and upload it as is
+    AtlasCacheKey key;
+    bool keyed = makeAtlasCacheKey(fontPath, pixelSize, cache.isSdf() ? SDF_SPREAD : 0, ATLAS_SIZE, codepoints, key);
+    MappedAtlasCache baked;
+    if (keyed && baked.open(ATLAS_CACHE_PATH, key))
     {
-        // Load character glyph
-        if (FT_Load_Char(face, c, FT_LOAD_RENDER))
+        for (GLuint c = 0; c < baked.glyphCount(); c++)
+            Characters.set(c, baked.character(c));
+        Characters.setMissing(Characters.get('?'));
+        cache.setStaticRegion(baked.pixels(), baked.atlasHeight());
+        std::cout << "Glyph atlas (" << (cache.isSdf() ? "SDF" : "bitmap") << "): loaded from " << ATLAS_CACHE_PATH
+                  << " in " << (glfwGetTime() - startTime) * 1000.0 << " ms" << std::endl;
+        return;
+    }
+    
+    // Rasterize every glyph up front on worker threads (distance fields or FreeType's bitmaps),
+    // then pack them here and upload the atlas once. Only this thread touches OpenGL.
+    AtlasPacker packer(ATLAS_SIZE, ATLAS_SIZE);
+    std::vector<GLubyte> pixels(ATLAS_SIZE * ATLAS_SIZE, 0);
+    std::vector<Character> characters(codepoints.size());
+    std::vector<GlyphImage> images;
+    std::vector<GLubyte> loaded;
+    GlyphRasterStats raster = rasterizeGlyphs(fontPath, pixelSize, cache.isSdf(), SDF_SPREAD,
+                                              codepoints, images, loaded, GLYPH_THREADS);
+    
+    for (GLuint c = 0; c < 128; c++)
+    {
+        const GlyphImage &image = images[c];
+        if (!loaded[c])
         {
             std::cout << "ERROR::FREETYTPE: Failed to load Glyph" << std::endl;
             continue;
         }
         
-        // Generate texture
-        GLuint texture;
-        glGenTextures(1, &texture);
-        glBindTexture(GL_TEXTURE_2D, texture);
-        glTexImage2D(
-                     GL_TEXTURE_2D,
-                     0,
-                     GL_RED,
-                     face->glyph->bitmap.width,
-                     face->glyph->bitmap.rows,
-                     0,
-                     GL_RED,
-                     GL_UNSIGNED_BYTE,
-                     face->glyph->bitmap.buffer
-                     );
-        // Set texture options
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        // Find a spot in the atlas and copy the image over row by row
+        int x, y;
+        if (!packer.pack(image.width, image.rows, x, y))
+        {
+            std::cout << "ERROR::FREETYTPE: Glyph atlas is full" << std::endl;
+            break;
+        }
+        for (int row = 0; row < image.rows; row++)
+            std::copy(image.pixels.begin() + row * image.width, image.pixels.begin() + (row + 1) * image.width,
+                      pixels.begin() + (y + row) * ATLAS_SIZE + x);
+        
         // Now store character for later use
         Character character = {
-            texture,
-            glm::ivec2(face->glyph->bitmap.width, face->glyph->bitmap.rows),
-            glm::ivec2(face->glyph->bitmap_left, face->glyph->bitmap_top),
-            face->glyph->advance.x
+            { texelToUnorm(x, ATLAS_SIZE), texelToUnorm(y, ATLAS_SIZE),
+              texelToUnorm(x + image.width, ATLAS_SIZE), texelToUnorm(y + image.rows, ATLAS_SIZE) },
+            glm::i16vec2(image.width, image.rows),
+            glm::i16vec2(image.left, image.top),
+            glyphAdvance(image.advance), // Fractional when unhinted
+            0
         };
-        Characters.insert(std::pair<GLchar, Character>(c, character));
+        Characters.set(c, character);
+        characters[c] = character;
     }
+    // Anything we have no glyph for is drawn as a question mark
+    Characters.setMissing(Characters.get('?'));
+    
+    // Upload the ASCII rows, everything below them becomes cache cells
+    GLint staticHeight = packer.usedHeight();
+    cache.setStaticRegion(&pixels[0], staticHeight);
+    if (keyed && !writeAtlasCache(ATLAS_CACHE_PATH, key, characters, &pixels[0], staticHeight))
+        std::cout << "ERROR::FREETYTPE: Failed to write " << ATLAS_CACHE_PATH << std::endl;
+    
+    // Report the cost of this glyph mode so the bitmap and SDF paths can be compared
+    std::cout << "Glyph atlas (" << (cache.isSdf() ? "SDF" : "bitmap") << "): "
+              << ATLAS_SIZE << "x" << ATLAS_SIZE << ", " << (ATLAS_SIZE * ATLAS_SIZE) / 1024 << " KB, ASCII in "
+              << staticHeight << " rows, " << cache.cellCount() << " cache cells, "
+              << "built in " << (glfwGetTime() - startTime) * 1000.0 << " ms" << std::endl;
+    std::cout << "Glyphs rasterized on " << raster.threads << " threads in " << raster.wallMs << " ms ("
+              << raster.busyMs << " ms of work, " << raster.busyMs / raster.wallMs << "x speedup)" << std::endl;
 }
 
-void fillTexture(GLuint &texture, const GLchar* imagePath,
-                 int wrap_s, int wrap_t, int min_filter, int mag_filter,
-                 int output_format, int input_format, int datatype_format)
+void flushTextBatch(void *batch)
 {
-    // GL_TEXTURE_2D specifies that we are working with 2D textures.
+    // The glyph cache is about to overwrite a glyph queued this frame: draw what is queued first
+    static_cast<TextBatch*>(batch)->flush(false);
+}
+
+#ifdef BENCHMARK_MIPMAPS
+// Builds the mip chain of an image with glGenerateMipmap, then with MipGenerator in every
+// instruction set and filter on one thread and on every core, and prints the average times
+void benchmarkMipmaps(const char *imagePath)
+{
+    const int RUNS = 10;
+    int width, height, channels;
+    unsigned char *image = stbi_load(imagePath, &width, &height, &channels, 0);
+    if (!image)
+    {
+        std::cout << "Failed to load texture " << imagePath << std::endl;
+        return;
+    }
+    GLenum format = channels == 4 ? GL_RGBA : channels == 3 ? GL_RGB : channels == 2 ? GL_RG : GL_RED;
+
+    GLuint texture;
+    glGenTextures(1, &texture);
     glBindTexture(GL_TEXTURE_2D, texture);
-    // Wrapping options. Either GL_REPEAT, GL_MIRRORED_REPEAT, GL_CLAMP_TO_EDGE, or GL_CLAMP_TO_BORDER.
-    // NOTE:: for GL_CLAMP_TO_BORDER. Must set colors of borders.
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap_s);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap_t);
-    // Minifying and magnifying texture filters.
-    // NOTE: For minifying you can set either combination of NEAREST or LINEAR filtering
-    // for MIPMAP and sampling
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, min_filter);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, mag_filter);
-    int width, height, nrChannels;
-    unsigned char *data = stbi_load(imagePath, &width, &height, &nrChannels, 0);
-    if (data)
+    glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, image);
+    glFinish();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int run = 0; run < RUNS; run++)
     {
-        // 1. We want 2D textures 2. Generate for base level of mipmap
-        // 3. Store texutres in GL_RGB format 4 & 5. width and height of the resulting texutres.
-        // 6. Always 0, "some legacy stuff!!!" 7. Format of the source image.
-        // 8. Datatype of the source image 9. Pointer to the data
-        glTexImage2D(GL_TEXTURE_2D, 0, output_format, width, height, 0, input_format, datatype_format, data);
         glGenerateMipmap(GL_TEXTURE_2D);
-        stbi_image_free(data);
+        glFinish();
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glDeleteTextures(1, &texture);
+    std::cout << "Mipmaps of " << imagePath << " (" << width << "x" << height << "x" << channels << "): "
+              << "glGenerateMipmap " << elapsed.count() / RUNS << " ms" << std::endl;
+
+    const char *FILTERS[3] = { "box", "box sRGB", "triangle sRGB" };
+    const unsigned THREADS[2] = { 1, 0 }; // 0: every core
+    std::vector<MipLevel> mips;
+    for (int t = 0; t < 2; t++)
+    {
+        MipGenerator generator(THREADS[t]);
+        for (int simd = MIP_SIMD_SCALAR; simd <= generator.simdLevel(); simd++)
+        {
+            MipGenerator limited = generator;
+            limited.limitSimd(static_cast<MipSimd>(simd));
+            std::cout << "  " << limited.threadCount() << " threads, " << MipGenerator::simdName(limited.simdLevel());
+            for (int f = 0; f < 3; f++)
+            {
+                start = std::chrono::steady_clock::now();
+                for (int run = 0; run < RUNS; run++)
+                    limited.generate(image, width, height, channels, f > 0,
+                                     f == 2 ? MIP_FILTER_TRIANGLE : MIP_FILTER_BOX, mips);
+                elapsed = std::chrono::steady_clock::now() - start;
+                std::cout << ", " << FILTERS[f] << " " << elapsed.count() / RUNS << " ms";
+            }
+            std::cout << std::endl;
+        }
     }
-    else
-        std::cout << "Failed to load texture." << std::endl;
+    stbi_image_free(image);
+}
+#endif
+
+// Called by shaderCompiler once the box shader is built
+void setupObjectShader(Shader &s)
+{
+    s.setInt("texture1", 0);
+    s.setInt("texture2", 1);
+    spriteRectUniform = s.uniform("spriteRect");
 }
 
-void RenderBox(Shader &s, GLFWwindow *window, GLint player)
+// Expects the wall texture on unit 0 and the sprite's atlas page on unit 1
+void RenderBox(Shader &s, GLFWwindow *window, GLint player, const Sprite &sprite)
 {
     GLfloat ctr_x = player == 1 ? -0.8f : 0.8f;
     GLfloat ctr_y = player == 1 ? ctr_y1 : ctr_y2;
@@ -342,13 +542,8 @@ void RenderBox(Shader &s, GLFWwindow *window, GLint player)
         ctr_x - off_x, ctr_y + off_y,  0.0f,   1.0f, 1.0f, 0.0f,   0.0f, 1.0f    // top left
     };
     
-    // Textures
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, textures[0]);
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, textures[1]);
-    
     s.use();
+    s.setVec4(spriteRectUniform, sprite.rect[0], sprite.rect[1], sprite.rect[2], sprite.rect[3]);
     glBindVertexArray(VAOs[player]);
     glBindBuffer(GL_ARRAY_BUFFER, VBOs[player]);
     glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices);
@@ -357,46 +552,9 @@ void RenderBox(Shader &s, GLFWwindow *window, GLint player)
     glBindVertexArray(0);
 }
 
-void RenderText(Shader &s, std::string text, GLfloat x, GLfloat y, GLfloat scale, glm::vec3 color)
+void RenderText(Shader &s, const std::string &text, GLfloat x, GLfloat y, GLfloat scale, glm::vec3 color)
 {
-    // Activate corresponding render state
-    s.use();
-    glUniform3f(glGetUniformLocation(s.programId, "textColor"), color.x, color.y, color.z);
-    glActiveTexture(GL_TEXTURE0);
-    glBindVertexArray(VAOs[0]);
-    
-    // Iterate through all characters
-    std::string::const_iterator c;
-    for (c = text.begin(); c != text.end(); c++)
-    {
-        Character ch = Characters[*c];
-        
-        GLfloat xpos = x + ch.Bearing.x * scale;
-        GLfloat ypos = y - (ch.Size.y - ch.Bearing.y) * scale;
-        
-        GLfloat w = ch.Size.x * scale;
-        GLfloat h = ch.Size.y * scale;
-        // Update VBO for each character
-        GLfloat vertices[6][4] = {
-            { xpos,     ypos + h,   0.0, 0.0 },
-            { xpos,     ypos,       0.0, 1.0 },
-            { xpos + w, ypos,       1.0, 1.0 },
-            
-            { xpos,     ypos + h,   0.0, 0.0 },
-            { xpos + w, ypos,       1.0, 1.0 },
-            { xpos + w, ypos + h,   1.0, 0.0 }
-        };
-        // Render glyph texture over quad
-        glBindTexture(GL_TEXTURE_2D, ch.TextureID);
-        // Update content of VBO memory
-        glBindBuffer(GL_ARRAY_BUFFER, VBOs[0]);
-        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-        // Render quad
-        glDrawArrays(GL_TRIANGLES, 0, 6);
-        // Now advance cursors for next glyph (note that advance is number of 1/64 pixels)
-        x += (ch.Advance >> 6) * scale; // Bitshift by 6 to get value in pixels (2^6 = 64)
-    }
-    glBindVertexArray(0);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    // Nothing is drawn here: the glyphs are queued in textBatch and drawn by textBatch.flush()
+    GLushort colorIndex = textBatch.paletteIndex(color);
+    layoutText(Characters, text, x, y, scale, colorIndex, textBatch.queue(s, glyphCache.texture()));
 }
@@ -0,0 +1,179 @@
+#ifndef FONT_MANAGER_H
+#define FONT_MANAGER_H
+
+#include <glad/glad.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include FT_CACHE_H
+#include FT_GLYPH_H
+
+#include <deque>
+#include <iostream>
+#include <string>
+
+typedef GLuint FontId;
+
+// Keeps any number of font files (weights, styles) usable at any pixel size on top of FreeType's
+// cache subsystem. FTC_Manager opens faces on demand and keeps the most recently used ones open
+// within the face/size/byte budget; glyph images and small bitmaps are cached the same way.
+// Handles returned by the lookups are only valid until the next lookup, copy what you need.
+class FontManager
+{
+public:
+    FontManager()
+        : manager(NULL), cmapCache(NULL), imageCache(NULL), sbitCache(NULL),
+          faceLookups(0), faceLoads(0), glyphLookups(0), glyphLoads(0)
+    {
+    }
+
+    // maxFaces/maxSizes: how many faces and sizes stay open, maxBytes: memory for cached glyphs (0 = default)
+    bool init(FT_Library library, FT_UInt maxFaces, FT_UInt maxSizes, FT_ULong maxBytes)
+    {
+        if (FTC_Manager_New(library, maxFaces, maxSizes, maxBytes, requestFace, this, &manager) ||
+            FTC_CMapCache_New(manager, &cmapCache) ||
+            FTC_ImageCache_New(manager, &imageCache) ||
+            FTC_SBitCache_New(manager, &sbitCache))
+        {
+            std::cout << "ERROR::FREETYPE: Could not create the font cache" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Also closes every face it opened
+    void destroy()
+    {
+        if (manager)
+            FTC_Manager_Done(manager);
+        manager = NULL;
+    }
+
+    // Registers a font file. Nothing is opened until a glyph or size of it is looked up.
+    FontId addFont(const std::string &path, FT_Long faceIndex = 0)
+    {
+        FontFile file = { path, faceIndex };
+        files.push_back(file);
+        return static_cast<FontId>(files.size() - 1);
+    }
+
+    const char *path(FontId font) const
+    {
+        return files[font].path.c_str();
+    }
+
+    // Face of the font with its size set to pixelSize, NULL when the file can't be opened
+    FT_Size size(FontId font, FT_UInt pixelSize)
+    {
+        FTC_ScalerRec scaler;
+        scaler.face_id = faceId(font);
+        scaler.width = 0;
+        scaler.height = pixelSize;
+        scaler.pixel = 1;
+        scaler.x_res = 0;
+        scaler.y_res = 0;
+        FT_Size size;
+        faceLookups++;
+        if (FTC_Manager_LookupSize(manager, &scaler, &size))
+            return NULL;
+        return size;
+    }
+
+    // 0 when the font has no glyph for the codepoint
+    FT_UInt glyphIndex(FontId font, GLuint codepoint)
+    {
+        faceLookups++;
+        return FTC_CMapCache_Lookup(cmapCache, faceId(font), -1, codepoint);
+    }
+
+    // Rendered bitmap from the small bitmap cache. Glyphs too big for it come back without a buffer.
+    bool bitmap(FontId font, FT_UInt pixelSize, FT_UInt glyph, FT_Int32 loadFlags, FTC_SBit &out)
+    {
+        FT_GlyphSlot slot = watchSlot(font, pixelSize);
+        if (!slot)
+            return false;
+        FTC_ImageTypeRec type = { faceId(font), 0, pixelSize, loadFlags };
+        bool found = FTC_SBitCache_Lookup(sbitCache, &type, glyph, &out, NULL) == 0;
+        countLoad(slot);
+        return found;
+    }
+
+    // Glyph image (outline, or bitmap with FT_LOAD_RENDER) from the image cache
+    bool image(FontId font, FT_UInt pixelSize, FT_UInt glyph, FT_Int32 loadFlags, FT_Glyph &out)
+    {
+        FT_GlyphSlot slot = watchSlot(font, pixelSize);
+        if (!slot)
+            return false;
+        FTC_ImageTypeRec type = { faceId(font), 0, pixelSize, loadFlags };
+        bool found = FTC_ImageCache_Lookup(imageCache, &type, glyph, &out, NULL) == 0;
+        countLoad(slot);
+        return found;
+    }
+
+    void printStats() const
+    {
+        std::cout << "Font cache: " << files.size() << " fonts, "
+                  << faceLookups << " face lookups (" << hitRate(faceLookups, faceLoads) << "% hit), "
+                  << glyphLookups << " glyph lookups (" << hitRate(glyphLookups, glyphLoads) << "% hit)" << std::endl;
+    }
+
+private:
+    struct FontFile
+    {
+        std::string path;
+        FT_Long faceIndex;
+    };
+
+    // FTC identifies faces by pointer, the deque keeps them stable while fonts are added
+    FTC_FaceID faceId(FontId font)
+    {
+        return static_cast<FTC_FaceID>(&files[font]);
+    }
+
+    // Called by FTC_Manager whenever it needs a face that isn't open (anymore)
+    static FT_Error requestFace(FTC_FaceID id, FT_Library library, FT_Pointer data, FT_Face *face)
+    {
+        FontManager *self = static_cast<FontManager*>(data);
+        const FontFile *file = static_cast<const FontFile*>(id);
+        self->faceLoads++;
+        FT_Error error = FT_New_Face(library, file->path.c_str(), file->faceIndex, face);
+        if (error)
+            std::cout << "ERROR::FREETYPE: Failed to load font " << file->path << std::endl;
+        return error;
+    }
+
+    // The caches don't report misses, but a miss loads the glyph through the face's slot.
+    // Clearing the slot's format before a lookup shows afterwards whether anything was loaded.
+    FT_GlyphSlot watchSlot(FontId font, FT_UInt pixelSize)
+    {
+        FT_Size sized = size(font, pixelSize);
+        if (!sized)
+            return NULL;
+        glyphLookups++;
+        sized->face->glyph->format = FT_GLYPH_FORMAT_NONE;
+        return sized->face->glyph;
+    }
+
+    void countLoad(FT_GlyphSlot slot)
+    {
+        if (slot->format != FT_GLYPH_FORMAT_NONE)
+            glyphLoads++;
+    }
+
+    static double hitRate(unsigned long lookups, unsigned long loads)
+    {
+        return lookups ? 100.0 * (lookups - loads) / lookups : 100.0;
+    }
+
+    FTC_Manager manager;
+    FTC_CMapCache cmapCache;
+    FTC_ImageCache imageCache;
+    FTC_SBitCache sbitCache;
+    std::deque<FontFile> files;
+
+    unsigned long faceLookups;
+    unsigned long faceLoads;
+    unsigned long glyphLookups;
+    unsigned long glyphLoads;
+};
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef GL_EXTENSIONS_H
+#define GL_EXTENSIONS_H
+
+#include <glad/glad.h>
+
+#include <cstring>
+
+// Whether the current context advertises an extension, e.g. "GL_EXT_texture_compression_s3tc".
+// Walks the whole list every call: look it up once and keep the answer.
+inline bool hasGLExtension(const char *name)
+{
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; i++)
+    {
+        const char *extension = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+        if (extension && std::strcmp(extension, name) == 0)
+            return true;
+    }
+    return false;
+}
+
+#endif
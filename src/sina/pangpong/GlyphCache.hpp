@@ -0,0 +1,290 @@
+#ifndef GLYPH_CACHE_H
+#define GLYPH_CACHE_H
+
+#include <glad/glad.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#include <algorithm>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+
+#include "GlyphTable.hpp"
+#include "GlyphRenderer.hpp"
+
+// Rasterizes glyphs on first use into a fixed size atlas. The top rows of the atlas are a static
+// region (ASCII, packed once at startup) and the rest is a grid of equal cells, one glyph each.
+// When every cell is taken the least recently used glyph is evicted, so a font with thousands of
+// codepoints costs one texture of fixed size and only the glyphs that are actually shown.
+class GlyphCache : public GlyphSource
+{
+public:
+    // Called before a cell drawn this frame is overwritten, so queued text is drawn with the old glyph
+    typedef void (*FlushCallback)(void *user);
+
+    GlyphCache(int sdfSpread)
+        : renderer(sdfSpread), spread(sdfSpread),
+          atlas(0), size(0), cellSize(0), gridTop(0), columns(0), capacity(0),
+          head(-1), tail(-1), frame(0), currentGeneration(0),
+          flushCallback(NULL), flushUser(NULL), hits(0), misses(0), evictions(0)
+    {
+    }
+
+    // Glyphs are rasterized on demand from the font at pixelSize, through the manager's caches
+    void init(FontManager &fonts, FontId font, FT_UInt pixelSize, bool useSdf, GLint atlasSize)
+    {
+        renderer.setFont(fonts, font, pixelSize, useSdf);
+        size = atlasSize;
+        // Every cell fits a full line of text. Distance fields also need their spread on each side.
+        FT_Size metrics = fonts.size(font, pixelSize);
+        GLint lineHeight = metrics ? static_cast<GLint>((metrics->metrics.height + 63) >> 6) : pixelSize;
+        cellSize = lineHeight + (useSdf ? 2 * spread : 0) + PADDING;
+
+        std::vector<GLubyte> empty(size * size, 0);
+        glGenTextures(1, &atlas);
+        glBindTexture(GL_TEXTURE_2D, atlas);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, size, size, 0, GL_RED, GL_UNSIGNED_BYTE, &empty[0]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    void destroy()
+    {
+        glDeleteTextures(1, &atlas);
+        atlas = 0;
+    }
+
+    // Uploads the first `height` rows of an atlas wide image and lays out the cache cells below them.
+    // Glyphs in the static region are never evicted.
+    void setStaticRegion(const GLubyte *pixels, GLint height)
+    {
+        if (height > 0)
+        {
+            glBindTexture(GL_TEXTURE_2D, atlas);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, size, height, GL_RED, GL_UNSIGNED_BYTE, pixels);
+            glBindTexture(GL_TEXTURE_2D, 0);
+        }
+        gridTop = height + PADDING;
+        columns = size / cellSize;
+        capacity = std::max(0, columns * ((size - gridTop) / cellSize));
+        if (capacity == 0)
+            std::cout << "ERROR::GLYPHCACHE: No room left in the atlas for cached glyphs" << std::endl;
+        slots.clear();
+        slots.reserve(capacity); // Never reallocates, lookup hands out pointers into it
+        index.clear();
+        blanks.clear();
+        head = tail = -1;
+        cellPixels.resize(cellSize * cellSize);
+    }
+
+    const Character *lookup(GLuint codepoint)
+    {
+        std::unordered_map<GLuint, GLint>::iterator found = index.find(codepoint);
+        if (found != index.end())
+        {
+            hits++;
+            if (found->second == NO_GLYPH)
+                return NULL;
+            if (found->second == BLANK_GLYPH)
+                return &blanks[codepoint];
+            touch(found->second);
+            return &slots[found->second].glyph;
+        }
+
+        // Miss: rasterize it now. Codepoints the font doesn't have are remembered as missing.
+        misses++;
+        if (!renderer.hasGlyph(codepoint) || !renderer.render(codepoint, image))
+        {
+            index[codepoint] = NO_GLYPH;
+            return NULL;
+        }
+        Character character = {
+            { 0, 0, 0, 0 },
+            glm::i16vec2(image.width, image.rows),
+            glm::i16vec2(image.left, image.top),
+            glyphAdvance(image.advance),
+            0
+        };
+        // Blank glyphs (spaces) only have an advance and need no cell
+        if (image.width == 0 || image.rows == 0)
+        {
+            character.Size = glm::i16vec2(0, 0);
+            index[codepoint] = BLANK_GLYPH;
+            return &(blanks[codepoint] = character);
+        }
+        if (image.width > cellSize - PADDING || image.rows > cellSize - PADDING)
+        {
+            std::cout << "ERROR::GLYPHCACHE: Glyph " << codepoint << " doesn't fit a cache cell" << std::endl;
+            index[codepoint] = NO_GLYPH;
+            return NULL;
+        }
+
+        if (capacity == 0)
+        {
+            index[codepoint] = NO_GLYPH;
+            return NULL;
+        }
+        GLint slot = allocate();
+        GLint x = (slot % columns) * cellSize;
+        GLint y = gridTop + (slot / columns) * cellSize;
+        // Upload the whole cell so nothing of the evicted glyph is left around the new one
+        std::fill(cellPixels.begin(), cellPixels.end(), 0);
+        for (int row = 0; row < image.rows; row++)
+            std::copy(image.pixels.begin() + row * image.width, image.pixels.begin() + (row + 1) * image.width,
+                      cellPixels.begin() + row * cellSize);
+        glBindTexture(GL_TEXTURE_2D, atlas);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, cellSize, cellSize, GL_RED, GL_UNSIGNED_BYTE, &cellPixels[0]);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        character.AtlasRect[0] = toUnorm(x);
+        character.AtlasRect[1] = toUnorm(y);
+        character.AtlasRect[2] = toUnorm(x + image.width);
+        character.AtlasRect[3] = toUnorm(y + image.rows);
+        Slot &entry = slots[slot];
+        entry.codepoint = codepoint;
+        entry.glyph = character;
+        index[codepoint] = slot;
+        return &entry.glyph;
+    }
+
+    // Bumped on every eviction: text laid out before may now point at another glyph's cell
+    GLuint generation() const { return currentGeneration; }
+
+    // Marks the start of a frame, glyphs looked up after this count as used by it
+    void beginFrame() { frame++; }
+
+    void setFlushCallback(FlushCallback callback, void *user)
+    {
+        flushCallback = callback;
+        flushUser = user;
+    }
+
+    void printStats() const
+    {
+        unsigned long lookups = hits + misses;
+        std::cout << "Glyph cache: " << slots.size() << "/" << capacity << " cells used, "
+                  << hits << " hits, " << misses << " misses, " << evictions << " evictions";
+        if (lookups > 0)
+            std::cout << " (" << (100.0 * hits) / lookups << "% hit rate)";
+        std::cout << std::endl;
+    }
+
+    GLuint texture() const { return atlas; }
+    GLint atlasSize() const { return size; }
+    bool isSdf() const { return renderer.isSdf(); }
+    GLint cellCount() const { return capacity; }
+
+private:
+    static const GLint PADDING = 1;
+    // Index values of codepoints that have no cell
+    static const GLint NO_GLYPH = -1;
+    static const GLint BLANK_GLYPH = -2;
+
+    struct Slot
+    {
+        GLuint codepoint;
+        Character glyph;
+        GLuint lastFrame;
+        GLint prev; // Towards the most recently used
+        GLint next; // Towards the least recently used
+    };
+
+    GLushort toUnorm(GLint texel) const
+    {
+        return static_cast<GLushort>((texel * 65535 + size / 2) / size);
+    }
+
+    // Returns a free cell, evicting the least recently used glyph when there is none left
+    GLint allocate()
+    {
+        GLint slot;
+        if (static_cast<GLint>(slots.size()) < capacity)
+        {
+            slot = static_cast<GLint>(slots.size());
+            slots.push_back(Slot());
+            link(slot);
+        }
+        else
+        {
+            slot = tail;
+            Slot &victim = slots[slot];
+            // Text queued this frame may still sample the cell, draw it before it changes
+            if (victim.lastFrame == frame && flushCallback)
+                flushCallback(flushUser);
+            index.erase(victim.codepoint);
+            evictions++;
+            currentGeneration++;
+            unlink(slot);
+            link(slot);
+        }
+        slots[slot].lastFrame = frame;
+        return slot;
+    }
+
+    void touch(GLint slot)
+    {
+        slots[slot].lastFrame = frame;
+        if (slot == head)
+            return;
+        unlink(slot);
+        link(slot);
+    }
+
+    // Inserts the slot at the most recently used end
+    void link(GLint slot)
+    {
+        slots[slot].prev = -1;
+        slots[slot].next = head;
+        if (head != -1)
+            slots[head].prev = slot;
+        head = slot;
+        if (tail == -1)
+            tail = slot;
+    }
+
+    void unlink(GLint slot)
+    {
+        Slot &entry = slots[slot];
+        if (entry.prev != -1)
+            slots[entry.prev].next = entry.next;
+        else
+            head = entry.next;
+        if (entry.next != -1)
+            slots[entry.next].prev = entry.prev;
+        else
+            tail = entry.prev;
+    }
+
+    GlyphRenderer renderer;
+    GlyphImage image;
+    std::vector<GLubyte> cellPixels;
+    int spread;
+
+    GLuint atlas;
+    GLint size;
+    GLint cellSize;
+    GLint gridTop;
+    GLint columns;
+    GLint capacity;
+
+    std::vector<Slot> slots;
+    std::unordered_map<GLuint, GLint> index; // Codepoint to slot, or NO_GLYPH/BLANK_GLYPH
+    std::unordered_map<GLuint, Character> blanks; // Element addresses stay valid across rehashes
+    GLint head;
+    GLint tail;
+    GLuint frame;
+    GLuint currentGeneration;
+
+    FlushCallback flushCallback;
+    void *flushUser;
+
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+};
+
+#endif
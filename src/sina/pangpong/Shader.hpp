@@ -4,10 +4,16 @@
 #include <glad/glad.h> // include glad to get all the required OpenGL headers
 
 #include <string>
-#include <fstream>
-#include <sstream>
 #include <iostream>
+#include <vector>
+#include <cstring>
 
+#include "FrameGlobals.hpp"
+#include "ProgramCache.hpp"
+
+// Index of an active uniform in a Shader's table (see Shader::uniform), -1 for one the program
+// doesn't have; setting it is then a no-op, like location -1 is for glUniform*
+typedef GLint UniformHandle;
 
 class Shader
 {
@@ -15,90 +21,224 @@ public:
     // the program programId
     unsigned int programId;
     
-    // constructor reads and builds the shader
-    Shader(const GLchar* vertexPath, const GLchar* fragmentPath)
-    {
-        // 1. retrieve the vertex/fragment source code from filePath
-        const GLchar *vShaderCode;
-        const GLchar *fShaderCode;
-        std::string vertexCode;
-        std::string fragmentCode;
-        std::ifstream vShaderFile;
-        std::ifstream fShaderFile;
-        // ensure ifstream objects can throw exceptions:
-        vShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-        fShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-        try
-        {
-            // open files
-            vShaderFile.open(vertexPath);
-            fShaderFile.open(fragmentPath);
-            std::stringstream vShaderStream, fShaderStream;
-            // read file's buffer contents into streams
-            vShaderStream << vShaderFile.rdbuf();
-            fShaderStream << fShaderFile.rdbuf();
-            // close file handlers
-            vShaderFile.close();
-            fShaderFile.close();
-            // convert stream into string
-            vertexCode   = vShaderStream.str();
-            fragmentCode = fShaderStream.str();
-            vShaderCode = vertexCode.c_str();
-            fShaderCode = fragmentCode.c_str();
-        }
-        catch(std::ifstream::failure e)
+    // constructor builds the shader from GLSL sources, e.g. the ones embedded at build time (see
+    // EmbeddedShaders.hpp)
+    // cache: where the linked program is looked up first and stored after a build, NULL to always build
+    // deferred: only submit the build, finish() completes it (see ShaderCompiler)
+    Shader(const GLchar* vShaderCode, const GLchar* fShaderCode, ProgramCache *cache = NULL, bool deferred = false)
+        : vertex(0), fragment(0), cache(cache), cacheKey(0), ready(false), uploads(0), skipped(0)
+    {
+        // 1. a binary of the same sources from an earlier run skips compiling and linking
+        programId = glCreateProgram();
+        cacheKey = cache ? cache->key(vShaderCode, fShaderCode) : 0;
+        if (cache && cache->load(programId, cacheKey))
         {
-            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+            reflectUniforms();
+            ready = true;
+            return;
         }
         
-        // 2. compile shaders
-        unsigned int vertex, fragment;
-        
+        // 2. compile shaders. Nothing is checked until finish(): asking for a status makes the driver
+        // complete the work right there
         // vertex Shader
         vertex = glCreateShader(GL_VERTEX_SHADER);
         glShaderSource(vertex, 1, &vShaderCode, NULL);
         glCompileShader(vertex);
-        checkCompileErrors(vertex, "VERTEX");
         
         // fragment Shader
         fragment = glCreateShader(GL_FRAGMENT_SHADER);
         glShaderSource(fragment, 1, &fShaderCode, NULL);
         glCompileShader(fragment);
-        checkCompileErrors(fragment, "FRAGMENT");
         
         // shader Program
-        programId = glCreateProgram();
         glAttachShader(programId, vertex);
         glAttachShader(programId, fragment);
+        if (cache)
+            cache->prepare(programId);
         glLinkProgram(programId);
-        checkCompileErrors(programId, "PROGRAM");
+        if (!deferred)
+            finish();
+    }
+    // Waits for the build and reports its errors. The shader can't be used before.
+    void finish()
+    {
+        if (ready)
+            return;
+        checkCompileErrors(vertex, "VERTEX");
+        checkCompileErrors(fragment, "FRAGMENT");
+        if (checkCompileErrors(programId, "PROGRAM") && cache)
+            cache->store(programId, cacheKey);
+        reflectUniforms();
         
         // delete the shaders as they're linked into our program now and no longer necessery
         glDeleteShader(vertex);
         glDeleteShader(fragment);
+        vertex = 0;
+        fragment = 0;
+        ready = true;
+    }
+    // Whether finish() was done, also when the build failed
+    bool isReady() const
+    {
+        return ready;
     }
     // use/activate the shader
     void use()
     {
         glUseProgram(programId);
     }
+    // Handle of an active uniform, -1 if the program has none by that name. Arrays go by their
+    // plain name ("textPalette", not "textPalette[0]"). Look it up once and keep it: the setters
+    // taking a handle cost no string work at all.
+    UniformHandle uniform(const std::string &name) const
+    {
+        for (size_t i = 0; i < uniforms.size(); i++)
+            if (uniforms[i].name == name)
+                return static_cast<UniformHandle>(i);
+        return -1;
+    }
+    // Type of the uniform as glGetActiveUniform reports it, e.g. GL_FLOAT_VEC4; GL_NONE for -1
+    GLenum uniformType(UniformHandle handle) const
+    {
+        return valid(handle) ? uniforms[handle].type : GL_NONE;
+    }
     // utility uniform functions
-    void setBool(const std::string &name, bool value) const
+    // The program has to be in use. A value equal to what the uniform was last set to is not
+    // uploaded again, the program still holds it.
+    void setBool(UniformHandle handle, bool value)
+    {
+        setInt(handle, (int)value);
+    }
+    void setInt(UniformHandle handle, int value)
+    {
+        if (changed(handle, &value, sizeof(value)))
+            glUniform1i(uniforms[handle].location, value);
+    }
+    void setFloat(UniformHandle handle, float value)
+    {
+        if (changed(handle, &value, sizeof(value)))
+            glUniform1f(uniforms[handle].location, value);
+    }
+    void setVec4(UniformHandle handle, float x, float y, float z, float w)
+    {
+        const GLfloat value[4] = { x, y, z, w };
+        if (changed(handle, value, sizeof(value)))
+            glUniform4fv(uniforms[handle].location, 1, value);
+    }
+    // The first `count` elements of a vec4 array
+    void setVec4Array(UniformHandle handle, const GLfloat *values, GLsizei count)
     {
-        glUniform1i(glGetUniformLocation(programId, name.c_str()), (int)value);
+        if (changed(handle, values, sizeof(GLfloat) * 4 * count))
+            glUniform4fv(uniforms[handle].location, count, values);
     }
-    void setInt(const std::string &name, int value) const
+    void setMat4(UniformHandle handle, const GLfloat *value)
     {
-        glUniform1i(glGetUniformLocation(programId, name.c_str()), value);
+        if (changed(handle, value, sizeof(GLfloat) * 16))
+            glUniformMatrix4fv(uniforms[handle].location, 1, GL_FALSE, value);
     }
-    void setFloat(const std::string &name, float value) const
+    // By name, for one-off setup: a lookup in the table every call
+    void setBool(const std::string &name, bool value)
     {
-        glUniform1f(glGetUniformLocation(programId, name.c_str()), value);
+        setBool(uniform(name), value);
+    }
+    void setInt(const std::string &name, int value)
+    {
+        setInt(uniform(name), value);
+    }
+    void setFloat(const std::string &name, float value)
+    {
+        setFloat(uniform(name), value);
+    }
+    void setVec4(const std::string &name, float x, float y, float z, float w)
+    {
+        setVec4(uniform(name), x, y, z, w);
+    }
+    void setMat4(const std::string &name, const GLfloat *value)
+    {
+        setMat4(uniform(name), value);
+    }
+
+    void printStats(const std::string &label) const
+    {
+        std::cout << "Uniforms (" << label << "): " << uniforms.size() << " active, " << uploads
+                  << " uploads, " << skipped << " skipped as unchanged" << std::endl;
     }
 private:
+    struct Uniform
+    {
+        std::string name;
+        GLenum type;
+        GLint size; // Array length, 1 for anything else
+        GLint location;
+        std::vector<GLubyte> value; // As last uploaded, empty before that
+    };
+
+    // Lists the active uniforms once after linking. Uniforms in blocks have no location and are left out,
+    // they are set through their buffer.
+    void reflectUniforms()
+    {
+        GLint count = 0;
+        GLint maxLength = 0;
+        glGetProgramiv(programId, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(programId, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::vector<GLchar> name(maxLength + 1);
+        for (GLint i = 0; i < count; i++)
+        {
+            Uniform entry;
+            GLsizei length = 0;
+            glGetActiveUniform(programId, i, static_cast<GLsizei>(name.size()), &length, &entry.size, &entry.type, &name[0]);
+            entry.name.assign(&name[0], length);
+            entry.location = glGetUniformLocation(programId, entry.name.c_str());
+            if (entry.location < 0)
+                continue;
+            if (entry.name.size() > 3 && entry.name.compare(entry.name.size() - 3, 3, "[0]") == 0)
+                entry.name.erase(entry.name.size() - 3);
+            uniforms.push_back(entry);
+        }
+        // Blocks shared by every program are pointed at their fixed binding point, the buffer is bound
+        // there once for all of them
+        GLuint frameGlobals = glGetUniformBlockIndex(programId, "FrameGlobals");
+        if (frameGlobals != GL_INVALID_INDEX)
+            glUniformBlockBinding(programId, frameGlobals, FRAME_GLOBALS_BINDING);
+    }
+
+    bool valid(UniformHandle handle) const
+    {
+        return handle >= 0 && handle < static_cast<UniformHandle>(uniforms.size());
+    }
+
+    // Whether the value differs from the last one uploaded, and if so remembers it as uploaded
+    bool changed(UniformHandle handle, const void *value, size_t bytes)
+    {
+        if (!valid(handle) || bytes == 0)
+            return false;
+        std::vector<GLubyte> &last = uniforms[handle].value;
+        if (last.size() >= bytes && std::memcmp(&last[0], value, bytes) == 0)
+        {
+            skipped++;
+            return false;
+        }
+        if (last.size() < bytes)
+            last.resize(bytes);
+        std::memcpy(&last[0], value, bytes);
+        uploads++;
+        return true;
+    }
+
+    // Until finish()
+    unsigned int vertex;
+    unsigned int fragment;
+    ProgramCache *cache;
+    uint64_t cacheKey;
+    bool ready;
+    std::vector<Uniform> uniforms;
+    size_t uploads;
+    size_t skipped;
+
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
-    void checkCompileErrors(unsigned int shader, std::string type)
+    // Returns whether it succeeded.
+    bool checkCompileErrors(unsigned int shader, std::string type)
     {
         int success;
         char infoLog[1024];
@@ -120,6 +260,7 @@ private:
                 std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
             }
         }
+        return success != 0;
     }
 };
 
@@ -0,0 +1,111 @@
+#ifndef SHADER_COMPILER_H
+#define SHADER_COMPILER_H
+
+#include <glad/glad.h>
+
+#include <vector>
+
+#include "GLExtensions.hpp"
+#include "Shader.hpp"
+
+// KHR_parallel_shader_compile (ARB_parallel_shader_compile has the same values) isn't in our GL 3.3 glad
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+typedef void (APIENTRYP MaxShaderCompilerThreadsProc)(GLuint count);
+
+// Builds shaders in the background of the main thread. Deferred Shaders are only submitted by their
+// constructor; checking a compile or link status right away would make the driver finish the build
+// there and then, one shader at a time. Instead they are added here and finished once the driver says
+// they are done, which needs GL_KHR_parallel_shader_compile: drivers with compiler threads then build
+// all of them at once while the app goes on with its startup, or its first frames.
+// Without the extension there is no asking whether a build is done, poll() then finishes everything.
+class ShaderCompiler
+{
+public:
+    // Called with the shader once it is finished, to set its uniforms and the like. The program is in use.
+    typedef void (*ReadyCallback)(Shader &shader);
+
+    ShaderCompiler()
+        : parallel(false)
+    {
+    }
+
+    // Needs the context current.
+    // load: the same loader glad was initialized with, the entry points aren't in our glad
+    void init(GLADloadproc load)
+    {
+        MaxShaderCompilerThreadsProc maxThreads = NULL;
+        if (hasGLExtension("GL_KHR_parallel_shader_compile"))
+            maxThreads = reinterpret_cast<MaxShaderCompilerThreadsProc>(load("glMaxShaderCompilerThreadsKHR"));
+        else if (hasGLExtension("GL_ARB_parallel_shader_compile"))
+            maxThreads = reinterpret_cast<MaxShaderCompilerThreadsProc>(load("glMaxShaderCompilerThreadsARB"));
+        parallel = maxThreads != NULL;
+        // As many threads as the driver likes, some drivers start with none
+        if (parallel)
+            maxThreads(0xFFFFFFFF);
+    }
+
+    bool isParallel() const { return parallel; }
+
+    // shader: a deferred Shader; it has to outlive its build
+    void add(Shader &shader, ReadyCallback ready = NULL)
+    {
+        Pending entry = { &shader, ready };
+        pending.push_back(entry);
+    }
+
+    // Finishes the shaders the driver is done with. Never waits when the driver compiles in parallel.
+    // True when no shader is left.
+    bool poll()
+    {
+        for (size_t i = 0; i < pending.size();)
+        {
+            GLint done = GL_TRUE;
+            if (parallel)
+                glGetProgramiv(pending[i].shader->programId, GL_COMPLETION_STATUS_KHR, &done);
+            if (done)
+                finish(i);
+            else
+                i++;
+        }
+        return pending.empty();
+    }
+
+    // Waits for one shader, for when it can't be done without
+    void finish(Shader &shader)
+    {
+        for (size_t i = 0; i < pending.size(); i++)
+            if (pending[i].shader == &shader)
+            {
+                finish(i);
+                return;
+            }
+    }
+
+    size_t pendingCount() const { return pending.size(); }
+
+private:
+    struct Pending
+    {
+        Shader *shader;
+        ReadyCallback ready;
+    };
+
+    void finish(size_t i)
+    {
+        Pending entry = pending[i];
+        pending.erase(pending.begin() + i);
+        entry.shader->finish();
+        if (entry.ready)
+        {
+            entry.shader->use();
+            entry.ready(*entry.shader);
+        }
+    }
+
+    bool parallel;
+    std::vector<Pending> pending;
+};
+
+#endif
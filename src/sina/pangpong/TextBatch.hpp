@@ -0,0 +1,213 @@
+#ifndef TEXT_BATCH_H
+#define TEXT_BATCH_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <vector>
+
+#include "Shader.hpp"
+
+// Per-instance record of one glyph, as read by vertex.glsl (24 bytes instead of 6 full vertices)
+struct GlyphInstance
+{
+    GLfloat  Position[2];  // Bottom left corner of the quad, in pixels
+    GLuint   Size;         // Quad width and height, packed as two half floats
+    GLushort AtlasRect[4]; // (u0, v0, u1, v1) normalized to 0..65535, v0 is the top of the glyph
+    GLushort ColorIndex;   // Entry of the textPalette uniform
+    GLushort Padding;
+};
+
+// Points the per-instance attributes (locations 1-4 of vertex.glsl) at the glyph with the given
+// index in the bound GL_ARRAY_BUFFER. Enables them and sets their divisor too when asked.
+inline void setGlyphInstanceAttribs(size_t first, bool enable = false)
+{
+    GLsizei stride = sizeof(GlyphInstance);
+    size_t base = first * sizeof(GlyphInstance);
+    // position
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride, (void*)(base));
+    // size
+    glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, stride, (void*)(base + 2 * sizeof(GLfloat)));
+    // atlas rectangle
+    glVertexAttribPointer(3, 4, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void*)(base + 3 * sizeof(GLfloat)));
+    // color index, kept as an integer
+    glVertexAttribIPointer(4, 1, GL_UNSIGNED_SHORT, stride, (void*)(base + 3 * sizeof(GLfloat) + 4 * sizeof(GLushort)));
+    if (!enable)
+        return;
+    for (GLuint i = 1; i <= 4; i++)
+    {
+        glEnableVertexAttribArray(i);
+        glVertexAttribDivisor(i, 1); // Advance once per glyph, not per corner
+    }
+}
+
+// Collects the glyphs of every RenderText call in a frame and draws them in one go.
+// Each glyph is a GlyphInstance; a static unit quad is stretched over it by the vertex shader.
+// Glyphs are grouped by shader and texture (i.e. by font), so a frame costs one upload
+// and one instanced draw per font no matter how many characters are on screen.
+class TextBatch
+{
+public:
+    // Colors are looked up in a small uniform array, this is its size in vertex.glsl
+    static const int PALETTE_SIZE = 16;
+
+    TextBatch()
+        : vao(0), instanceVBO(0), quadVBO(0), capacity(0), drawCalls(0), instanceCount(0), lastGroup(0)
+    {
+    }
+
+    // Takes over a VAO/VBO pair for the instance stream and sets up the GlyphInstance layout on it.
+    void init(GLuint vertexArray, GLuint vertexBuffer, GLsizei initialGlyphs = 1024)
+    {
+        vao = vertexArray;
+        instanceVBO = vertexBuffer;
+        capacity = initialGlyphs;
+        // Unit quad as a triangle strip, (0, 0) is the bottom left corner
+        const GLfloat corners[] = {
+            0.0f, 0.0f,
+            1.0f, 0.0f,
+            0.0f, 1.0f,
+            1.0f, 1.0f
+        };
+        glGenBuffers(1, &quadVBO);
+        glBindVertexArray(vao);
+        glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GLfloat), (void*)0);
+        glEnableVertexAttribArray(0);
+
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(GlyphInstance) * capacity, NULL, GL_STREAM_DRAW);
+        setGlyphInstanceAttribs(0, true);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindVertexArray(0);
+    }
+
+    void destroy()
+    {
+        glDeleteBuffers(1, &quadVBO);
+        quadVBO = 0;
+    }
+
+    // Returns the palette entry for a color. Look it up once per string, not per glyph.
+    GLushort paletteIndex(const glm::vec3 &color)
+    {
+        glm::vec4 rgba(color, 1.0f);
+        for (size_t i = 0; i < palette.size(); i++)
+            if (palette[i] == rgba)
+                return static_cast<GLushort>(i);
+        // Out of palette entries: draw what we have and start over
+        if (palette.size() == PALETTE_SIZE)
+            flush();
+        palette.push_back(rgba);
+        return static_cast<GLushort>(palette.size() - 1);
+    }
+
+    // Glyphs appended to the returned vector are drawn with this shader and texture at the next flush.
+    std::vector<GlyphInstance> &queue(Shader &s, GLuint texture)
+    {
+        return groupFor(s, texture).glyphs;
+    }
+
+    // Uploads everything queued since the last flush and draws it. Call before swapping buffers.
+    // Flushing in the middle of a frame keeps the palette so indices handed out earlier stay valid.
+    void flush(bool resetPalette = true)
+    {
+        drawCalls = 0;
+        instanceCount = 0;
+        for (size_t i = 0; i < groups.size(); i++)
+            instanceCount += groups[i].glyphs.size();
+        if (instanceCount == 0)
+        {
+            if (resetPalette)
+                palette.clear();
+            return;
+        }
+
+        // Concatenate the groups so the whole frame goes up in a single call
+        staging.clear();
+        for (size_t i = 0; i < groups.size(); i++)
+            staging.insert(staging.end(), groups[i].glyphs.begin(), groups[i].glyphs.end());
+
+        glBindVertexArray(vao);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        while (capacity < instanceCount)
+            capacity *= 2;
+        // Orphan the old storage so we never wait on the previous frame's draws
+        glBufferData(GL_ARRAY_BUFFER, sizeof(GlyphInstance) * capacity, NULL, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(GlyphInstance) * instanceCount, &staging[0]);
+
+        glActiveTexture(GL_TEXTURE0);
+        GLuint first = 0;
+        for (size_t i = 0; i < groups.size(); i++)
+        {
+            Group &group = groups[i];
+            GLsizei count = static_cast<GLsizei>(group.glyphs.size());
+            if (count == 0)
+                continue;
+            group.shader->use();
+            group.shader->setVec4Array(group.paletteUniform, glm::value_ptr(palette[0]), static_cast<GLsizei>(palette.size()));
+            glBindTexture(GL_TEXTURE_2D, group.texture);
+            // GL 3.3 has no base instance, so point the per-instance attributes at this group's slice
+            setGlyphInstanceAttribs(first);
+            glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, count);
+            first += count;
+            drawCalls++;
+            // Keep the capacity around, next frame will need about the same amount
+            group.glyphs.clear();
+        }
+        setGlyphInstanceAttribs(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindVertexArray(0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        if (resetPalette)
+            palette.clear();
+    }
+
+    // Static unit quad the glyph instances are stretched from, shared with retained labels
+    GLuint unitQuad() const { return quadVBO; }
+
+    // Stats of the last flush
+    GLsizei lastDrawCalls() const { return drawCalls; }
+    size_t lastGlyphCount() const { return instanceCount; }
+
+private:
+    struct Group
+    {
+        Shader *shader;
+        GLuint texture;
+        UniformHandle paletteUniform;
+        std::vector<GlyphInstance> glyphs;
+    };
+
+    Group &groupFor(Shader &s, GLuint texture)
+    {
+        // Consecutive glyphs almost always share a font, so check the last hit first
+        if (lastGroup < groups.size() && groups[lastGroup].shader == &s && groups[lastGroup].texture == texture)
+            return groups[lastGroup];
+        // Only a handful of fonts are ever live, a linear scan beats any lookup structure
+        for (lastGroup = 0; lastGroup < groups.size(); lastGroup++)
+            if (groups[lastGroup].shader == &s && groups[lastGroup].texture == texture)
+                return groups[lastGroup];
+        Group group;
+        group.shader = &s;
+        group.texture = texture;
+        group.paletteUniform = s.uniform("textPalette");
+        groups.push_back(group);
+        return groups.back();
+    }
+
+    GLuint vao;
+    GLuint instanceVBO;
+    GLuint quadVBO;
+    size_t capacity;
+    GLsizei drawCalls;
+    size_t instanceCount;
+    size_t lastGroup;
+    std::vector<Group> groups;
+    std::vector<GlyphInstance> staging;
+    std::vector<glm::vec4> palette;
+};
+
+#endif
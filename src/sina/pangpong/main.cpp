@@ -1,5 +1,6 @@
 #include <iostream>
-#include <map>
+#include <algorithm>
+#include <vector>
 #include <string>
 #include <glad/glad.h>
 //#define GLEW_STATIC
@@ -12,6 +13,18 @@
 #include FT_FREETYPE_H
 
 #include "Shader.hpp"
+#include "ProgramCache.hpp"
+#include "ShaderCompiler.hpp"
+#include "FrameGlobals.hpp"
+#include "EmbeddedShaders.hpp" // Generated from src/sina/GLSL at build time
+#include "AtlasPacker.hpp"
+#include "TextBatch.hpp"
+#include "GlyphTable.hpp"
+#include "TextLabel.hpp"
+#include "SdfGenerator.hpp"
+#include "GlyphCache.hpp"
+#include "AtlasCache.hpp"
+#include "FontManager.hpp"
 
 #define ERR_RTN -1
 
@@ -19,23 +32,39 @@
 const GLuint WIDTH = 800;
 const GLuint HEIGHT = 600;
 
+// Text settings. Text scales are relative to FONT_SIZE.
+const char *FONT_PATH = "../../src/sina/fonts/open-sans/OpenSans-Regular.ttf";
+// With SDF_TEXT the glyphs are signed distance fields built at SDF_FONT_SIZE: one small atlas
+// stays sharp at every scale. Without it FreeType rasterizes bitmaps at FONT_SIZE.
+const bool SDF_TEXT = true;
+const GLuint FONT_SIZE = 48;
+const GLuint SDF_FONT_SIZE = 32;
+const GLint SDF_SPREAD = 4; // Pixels (at SDF_FONT_SIZE) covered by the distance field on each side of the edge
+const unsigned GLYPH_THREADS = 0; // Threads rasterizing the glyphs at startup, 0 uses every core
+const GLint GLYPH_ATLAS_SIZE = 1024; // ASCII is packed at the top, the rest is a cache of glyphs rasterized on first use
+const char *ATLAS_CACHE_PATH = "font_atlas.cache"; // Baked ASCII atlas, reused by the next start when nothing changed
+const char *PROGRAM_CACHE_DIR = "shader_cache"; // Linked shader programs, reused by the next start on the same driver
+// Budget of the FreeType cache behind the font manager: open faces, open sizes and bytes of cached glyphs
+const FT_UInt FONT_CACHE_MAX_FACES = 4;
+const FT_UInt FONT_CACHE_MAX_SIZES = 8;
+const FT_ULong FONT_CACHE_MAX_BYTES = 1024 * 1024;
+
 void framebuffer_size_callback(GLFWwindow *window, int width, int height);
 void processInput(GLFWwindow *window);
-void fillCharacterMap(FT_Face &face);
+GLushort texelToUnorm(GLint texel, GLint size);
+void fillCharacterMap(GlyphCache &cache, const char *fontPath, FT_UInt pixelSize);
+void flushTextBatch(void *batch);
 void RenderBox(Shader &s, GLFWwindow *window, GLint player);
-void RenderText(Shader &s, std::string text, GLfloat x, GLfloat y, GLfloat scale, glm::vec3 color);
+void RenderText(Shader &s, const std::string &text, GLfloat x, GLfloat y, GLfloat scale, glm::vec3 color);
 
 std::string VertexBufferStr;
 std::string FragmentBufferStr;
 
-struct Character {
-    GLuint     TextureID;  // ID handle of the glyph texture
-    glm::ivec2 Size;       // Size of glyph
-    glm::ivec2 Bearing;    // Offset from baseline to left/top of glyph
-    GLuint     Advance;    // Offset to advance to next glyph
-};
-
-std::map<GLchar, Character> Characters;
+GlyphTable Characters; // Glyph metrics, indexed directly by codepoint
+FontManager fonts; // Every font file and size, opened on demand and kept in FreeType's cache
+GlyphCache glyphCache(SDF_SPREAD); // Single texture holding every glyph of the font, non-ASCII ones loaded lazily
+TextBatch textBatch; // Collects all the text of a frame, drawn at once before the swap
+FrameGlobals frameGlobals; // Projection, viewport and time in one uniform buffer read by every shader
 GLuint VAOs[3];
 GLuint VBOs[3];
 GLuint EBO;
@@ -90,31 +119,35 @@ int main()
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     
-    Shader vfShader("../../src/sina/GLSL/vertex.glsl", "../../src/sina/GLSL/fragment.glsl");
-    Shader object_vfShader("../../src/sina/GLSL/vertex_object.glsl", "../../src/sina/GLSL/fragment_object.glsl");
-    // Set up the projection as orthographic. (text doesn't need perspective)
-    glm::mat4 projection = glm::ortho(0.0f, static_cast<GLfloat>(WIDTH), 0.0f, static_cast<GLfloat>(HEIGHT));
-    vfShader.use();
-    glUniformMatrix4fv(glGetUniformLocation(vfShader.programId, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+    // The shaders are only submitted here, the driver builds them while the fonts load below
+    ProgramCache programCache;
+    programCache.init((GLADloadproc)glfwGetProcAddress, PROGRAM_CACHE_DIR);
+    ShaderCompiler shaderCompiler;
+    shaderCompiler.init((GLADloadproc)glfwGetProcAddress);
+    Shader vfShader(GLSL_TEXT_VERTEX, SDF_TEXT ? GLSL_TEXT_FRAGMENT_SDF : GLSL_TEXT_FRAGMENT, &programCache, true);
+    Shader object_vfShader(GLSL_OBJECT_VERTEX, GLSL_OBJECT_FRAGMENT, &programCache, true);
+    shaderCompiler.add(vfShader);
+    shaderCompiler.add(object_vfShader);
     
     // Font creation
     FT_Library ft;
     if (FT_Init_FreeType(&ft)) // Intialize
         std::cout << "ERROR::FREETYPE: Could not init FreeType Library" << std::endl;
     
-    FT_Face face;
-    if (FT_New_Face(ft, "../../src/sina/fonts/open-sans/OpenSans-Regular.ttf", 0, &face)) // Load the font
-        std::cout << "ERROR::FREETYPE: Failed to load font" << std::endl;
+    // Faces are opened by the font manager when first needed and stay open while they are in use
+    fonts.init(ft, FONT_CACHE_MAX_FACES, FONT_CACHE_MAX_SIZES, FONT_CACHE_MAX_BYTES);
+    FontId regularFont = fonts.addFont(FONT_PATH);
     
-    // Sets the font's width and height parameters.
-    // Setting the width to 0 lets the face dynamically calculate the width based on the given height.
-    FT_Set_Pixel_Sizes(face, 0, 48);
+    // Glyphs are rasterized at this height, the width follows from it
+    GLuint glyphSize = SDF_TEXT ? SDF_FONT_SIZE : FONT_SIZE;
+    Characters.setMetricScale(FONT_SIZE / static_cast<GLfloat>(glyphSize));
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // Disable byte-alignment restriction
     
-    fillCharacterMap(face);
-    
-    FT_Done_Face(face);
-    FT_Done_FreeType(ft);
+    // Glyphs past ASCII are rasterized the first time they are drawn
+    glyphCache.init(fonts, regularFont, glyphSize, SDF_TEXT, GLYPH_ATLAS_SIZE);
+    fillCharacterMap(glyphCache, fonts.path(regularFont), glyphSize);
+    Characters.setFallback(&glyphCache);
+    glyphCache.setFlushCallback(flushTextBatch, &textBatch);
     ///////////////
     unsigned int indices[] = {  // note that we start from 0!
         3, 1, 0,   // first triangle
@@ -125,23 +158,9 @@ int main()
     glGenVertexArrays(3, VAOs);
     glGenBuffers(3, VBOs);
     glGenBuffers(1, &EBO);
-    // bind Vertex Array Object
-    glBindVertexArray(VAOs[0]);
-    
-    glBindBuffer(GL_ARRAY_BUFFER, VBOs[0]);
-    // Either static, dynamic or stream draw. Static: less likely to change.
-    // Dynamic: likely to change. Stream: will change on every frame.
-    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * 6 * 4, NULL, GL_DYNAMIC_DRAW);
-    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), 0);
-    glEnableVertexAttribArray(0);
-    // note that this is allowed, the call to glVertexAttribPointer registered VBO as the vertex attribute's bound vertex
-    // buffer object so afterwards we can safely unbind
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    // You can unbind the VAO afterwards so other VAO calls won't accidentally modify this VAO, but this rarely happens.
-    // Modifying other
-    // VAOs requires a call to glBindVertexArray anyways so we generally don't unbind VAOs (nor VBOs) when it's not directly
-    // necessary.
-    glBindVertexArray(0);
+    // The text VAO/VBO are handed to the batcher which owns their vertex layout.
+    // The VBO holds one GlyphInstance per glyph, orphaned and refilled every frame (GL_STREAM_DRAW).
+    textBatch.init(VAOs[0], VBOs[0]);
     
     glBindVertexArray(VAOs[1]);
     glBindBuffer(GL_ARRAY_BUFFER, VBOs[1]);
@@ -170,10 +189,41 @@ int main()
     // To show out shape in WireFrame mode.
     //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
     
+    // Text that doesn't change is laid out once and stays on the GPU, drawing it costs a single draw call.
+    // Use RenderText for text that changes from frame to frame.
+    TextLabel titleLabel, subtitleLabel, scoreLabel;
+    titleLabel.init(textBatch);
+    titleLabel.set("OpenGL Tutorial", 8.0f, 570.0f, 0.5f);
+    subtitleLabel.init(textBatch);
+    subtitleLabel.set("PangPong", 8.0f, 550.0f, 0.25f);
+    scoreLabel.init(textBatch);
+    scoreLabel.set("0 : 0", 300.0f, 520.0f, 2.0f);
+    
+    // The glyph cache can flush queued text at any time, so the text shader is needed from the first frame.
+    // The boxes are left out until theirs is ready.
+    shaderCompiler.finish(vfShader);
+    shaderCompiler.poll();
+    programCache.printStats();
+    
+    // Set up the projection as orthographic. (text doesn't need perspective)
+    glm::mat4 projection = glm::ortho(0.0f, static_cast<GLfloat>(WIDTH), 0.0f, static_cast<GLfloat>(HEIGHT));
+    frameGlobals.init();
+    double firstFrame = glfwGetTime();
+    double lastFrame = firstFrame;
+    
     // Rendering/Game loop
     while(!glfwWindowShouldClose(window))
     {
         processInput(window); // Check if window needs to be closed
+        glyphCache.beginFrame();
+        shaderCompiler.poll();
+        // Written once here for every shader
+        int framebufferWidth, framebufferHeight;
+        glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+        double now = glfwGetTime();
+        frameGlobals.update(projection, framebufferWidth, framebufferHeight, static_cast<GLfloat>(now - firstFrame),
+                            static_cast<GLfloat>(now - lastFrame));
+        lastFrame = now;
         
         // Actual rendering code
         glClearColor(0.0f, 0.0f, 0.0f, 1.0f); // State-setting function
@@ -181,11 +231,15 @@ int main()
         
         // ----------------- // ----------------- //
         // What we like to draw goes here:
-        RenderBox(object_vfShader, window, 1);
-        RenderBox(object_vfShader, window, 2);
-        RenderText(vfShader, "OpenGL Tutorial", 8.0f, 570.0f, 0.5f, glm::vec3(1.0, 1.0f, 1.0f));
-        RenderText(vfShader, "PangPong", 8.0f, 550.0f, 0.25f, glm::vec3(1.0, 1.0f, 1.0f));
-        RenderText(vfShader, "0 : 0", 300.0f, 520.0f, 2.0f, glm::vec3(1.0, 1.0f, 1.0f));
+        if (object_vfShader.isReady())
+        {
+            RenderBox(object_vfShader, window, 1);
+            RenderBox(object_vfShader, window, 2);
+        }
+        titleLabel.draw(vfShader, glyphCache.texture(), Characters);
+        subtitleLabel.draw(vfShader, glyphCache.texture(), Characters);
+        scoreLabel.draw(vfShader, glyphCache.texture(), Characters);
+        textBatch.flush(); // RenderText calls go out in one upload and one instanced draw per font
         // ----------------- // ----------------- //
         
         glfwSwapBuffers(window); // Related to the screen double buffer. Need to swap the front with the back buffer
@@ -196,6 +250,18 @@ int main()
     glDeleteVertexArrays(3, VAOs);
     glDeleteBuffers(3, VBOs);
     glDeleteBuffers(1, &EBO);
+    glyphCache.printStats();
+    glyphCache.destroy();
+    fonts.printStats();
+    fonts.destroy();
+    FT_Done_FreeType(ft);
+    vfShader.printStats("text");
+    frameGlobals.printStats();
+    frameGlobals.destroy();
+    textBatch.destroy();
+    titleLabel.destroy();
+    subtitleLabel.destroy();
+    scoreLabel.destroy();
     
     glfwTerminate(); // Clean GLFW properly
     return 0;
@@ -222,46 +288,100 @@ void processInput(GLFWwindow *window)
         ctr_y2 -= 0.02f;
 }
 
-void fillCharacterMap(FT_Face &face)
+GLushort texelToUnorm(GLint texel, GLint size)
+{
+    return static_cast<GLushort>((texel * 65535 + size / 2) / size);
+}
+
+void fillCharacterMap(GlyphCache &cache, const char *fontPath, FT_UInt pixelSize)
 {
-    for (GLubyte c = 0; c < 128; c++)
+    // All glyphs live in one atlas so text only ever samples from a single texture.
+    // ASCII is packed tightly into its top rows once; the cache hands out the space below on demand.
+    const int ATLAS_SIZE = cache.atlasSize();
+    double startTime = glfwGetTime();
+    std::vector<GLuint> codepoints;
+    for (GLuint c = 0; c < 128; c++)
+        codepoints.push_back(c);
+    
+    // A previous run may have baked this exact atlas already: map it and upload it as is
+    AtlasCacheKey key;
+    bool keyed = makeAtlasCacheKey(fontPath, pixelSize, cache.isSdf() ? SDF_SPREAD : 0, ATLAS_SIZE, codepoints, key);
+    MappedAtlasCache baked;
+    if (keyed && baked.open(ATLAS_CACHE_PATH, key))
+    {
+        for (GLuint c = 0; c < baked.glyphCount(); c++)
+            Characters.set(c, baked.character(c));
+        Characters.setMissing(Characters.get('?'));
+        cache.setStaticRegion(baked.pixels(), baked.atlasHeight());
+        std::cout << "Glyph atlas (" << (cache.isSdf() ? "SDF" : "bitmap") << "): loaded from " << ATLAS_CACHE_PATH
+                  << " in " << (glfwGetTime() - startTime) * 1000.0 << " ms" << std::endl;
+        return;
+    }
+    
+    // Rasterize every glyph up front on worker threads (distance fields or FreeType's bitmaps),
+    // then pack them here and upload the atlas once. Only this thread touches OpenGL.
+    AtlasPacker packer(ATLAS_SIZE, ATLAS_SIZE);
+    std::vector<GLubyte> pixels(ATLAS_SIZE * ATLAS_SIZE, 0);
+    std::vector<Character> characters(codepoints.size());
+    std::vector<GlyphImage> images;
+    std::vector<GLubyte> loaded;
+    GlyphRasterStats raster = rasterizeGlyphs(fontPath, pixelSize, cache.isSdf(), SDF_SPREAD,
+                                              codepoints, images, loaded, GLYPH_THREADS);
+    
+    for (GLuint c = 0; c < 128; c++)
     {
-        // Load character glyph
-        if (FT_Load_Char(face, c, FT_LOAD_RENDER))
+        const GlyphImage &image = images[c];
+        if (!loaded[c])
         {
             std::cout << "ERROR::FREETYTPE: Failed to load Glyph" << std::endl;
             continue;
         }
         
-        // Generate texture
-        GLuint texture;
-        glGenTextures(1, &texture);
-        glBindTexture(GL_TEXTURE_2D, texture);
-        glTexImage2D(
-                     GL_TEXTURE_2D,
-                     0,
-                     GL_RED,
-                     face->glyph->bitmap.width,
-                     face->glyph->bitmap.rows,
-                     0,
-                     GL_RED,
-                     GL_UNSIGNED_BYTE,
-                     face->glyph->bitmap.buffer
-                     );
-        // Set texture options
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        // Find a spot in the atlas and copy the image over row by row
+        int x, y;
+        if (!packer.pack(image.width, image.rows, x, y))
+        {
+            std::cout << "ERROR::FREETYTPE: Glyph atlas is full" << std::endl;
+            break;
+        }
+        for (int row = 0; row < image.rows; row++)
+            std::copy(image.pixels.begin() + row * image.width, image.pixels.begin() + (row + 1) * image.width,
+                      pixels.begin() + (y + row) * ATLAS_SIZE + x);
+        
         // Now store character for later use
         Character character = {
-            texture,
-            glm::ivec2(face->glyph->bitmap.width, face->glyph->bitmap.rows),
-            glm::ivec2(face->glyph->bitmap_left, face->glyph->bitmap_top),
-            face->glyph->advance.x
+            { texelToUnorm(x, ATLAS_SIZE), texelToUnorm(y, ATLAS_SIZE),
+              texelToUnorm(x + image.width, ATLAS_SIZE), texelToUnorm(y + image.rows, ATLAS_SIZE) },
+            glm::i16vec2(image.width, image.rows),
+            glm::i16vec2(image.left, image.top),
+            glyphAdvance(image.advance), // Fractional when unhinted
+            0
         };
-        Characters.insert(std::pair<GLchar, Character>(c, character));
+        Characters.set(c, character);
+        characters[c] = character;
     }
+    // Anything we have no glyph for is drawn as a question mark
+    Characters.setMissing(Characters.get('?'));
+    
+    // Upload the ASCII rows, everything below them becomes cache cells
+    GLint staticHeight = packer.usedHeight();
+    cache.setStaticRegion(&pixels[0], staticHeight);
+    if (keyed && !writeAtlasCache(ATLAS_CACHE_PATH, key, characters, &pixels[0], staticHeight))
+        std::cout << "ERROR::FREETYTPE: Failed to write " << ATLAS_CACHE_PATH << std::endl;
+    
+    // Report the cost of this glyph mode so the bitmap and SDF paths can be compared
+    std::cout << "Glyph atlas (" << (cache.isSdf() ? "SDF" : "bitmap") << "): "
+              << ATLAS_SIZE << "x" << ATLAS_SIZE << ", " << (ATLAS_SIZE * ATLAS_SIZE) / 1024 << " KB, ASCII in "
+              << staticHeight << " rows, " << cache.cellCount() << " cache cells, "
+              << "built in " << (glfwGetTime() - startTime) * 1000.0 << " ms" << std::endl;
+    std::cout << "Glyphs rasterized on " << raster.threads << " threads in " << raster.wallMs << " ms ("
+              << raster.busyMs << " ms of work, " << raster.busyMs / raster.wallMs << "x speedup)" << std::endl;
+}
+
+void flushTextBatch(void *batch)
+{
+    // The glyph cache is about to overwrite a glyph queued this frame: draw what is queued first
+    static_cast<TextBatch*>(batch)->flush(false);
 }
 
 void RenderBox(Shader &s, GLFWwindow *window, GLint player)
@@ -284,46 +404,9 @@ void RenderBox(Shader &s, GLFWwindow *window, GLint player)
     glBindVertexArray(0);
 }
 
-void RenderText(Shader &s, std::string text, GLfloat x, GLfloat y, GLfloat scale, glm::vec3 color)
+void RenderText(Shader &s, const std::string &text, GLfloat x, GLfloat y, GLfloat scale, glm::vec3 color)
 {
-    // Activate corresponding render state
-    s.use();
-    glUniform3f(glGetUniformLocation(s.programId, "textColor"), color.x, color.y, color.z);
-    glActiveTexture(GL_TEXTURE0);
-    glBindVertexArray(VAOs[0]);
-    
-    // Iterate through all characters
-    std::string::const_iterator c;
-    for (c = text.begin(); c != text.end(); c++)
-    {
-        Character ch = Characters[*c];
-        
-        GLfloat xpos = x + ch.Bearing.x * scale;
-        GLfloat ypos = y - (ch.Size.y - ch.Bearing.y) * scale;
-        
-        GLfloat w = ch.Size.x * scale;
-        GLfloat h = ch.Size.y * scale;
-        // Update VBO for each character
-        GLfloat vertices[6][4] = {
-            { xpos,     ypos + h,   0.0, 0.0 },
-            { xpos,     ypos,       0.0, 1.0 },
-            { xpos + w, ypos,       1.0, 1.0 },
-            
-            { xpos,     ypos + h,   0.0, 0.0 },
-            { xpos + w, ypos,       1.0, 1.0 },
-            { xpos + w, ypos + h,   1.0, 0.0 }
-        };
-        // Render glyph texture over quad
-        glBindTexture(GL_TEXTURE_2D, ch.TextureID);
-        // Update content of VBO memory
-        glBindBuffer(GL_ARRAY_BUFFER, VBOs[0]);
-        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-        // Render quad
-        glDrawArrays(GL_TRIANGLES, 0, 6);
-        // Now advance cursors for next glyph (note that advance is number of 1/64 pixels)
-        x += (ch.Advance >> 6) * scale; // Bitshift by 6 to get value in pixels (2^6 = 64)
-    }
-    glBindVertexArray(0);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    // Nothing is drawn here: the glyphs are queued in textBatch and drawn by textBatch.flush()
+    GLushort colorIndex = textBatch.paletteIndex(color);
+    layoutText(Characters, text, x, y, scale, colorIndex, textBatch.queue(s, glyphCache.texture()));
 }
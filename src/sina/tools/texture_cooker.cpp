@@ -0,0 +1,116 @@
+// Offline texture cooker: decodes an image once at build time and writes it with its whole mip
+// chain as a cooked texture (see CookedTexture.hpp), so the app never decodes or mipmaps it.
+//
+// Usage: textureCooker <input image> <output .tex> <rgb|rgba|bc1|bc3|bc4> [box|triangle]
+// The third argument is the format the texture gets on the GPU: uncompressed RGBA (rgb drops the
+// alpha, both are uploaded as RGBA, see PixelConverter.hpp), or block compressed (see
+// BlockCompressor.hpp) BC1 for RGB, BC3 for RGBA or BC4 for one channel data like masks.
+// box|triangle is the mip filter (box by default).
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <glad/glad.h>
+#include <stb_image.h>
+
+#include "../general/BlockCompressor.hpp"
+#include "../general/CookedTexture.hpp"
+#include "../general/MipGenerator.hpp"
+#include "../general/PixelConverter.hpp"
+
+const char *const FORMAT_NAMES[5] = { "rgb", "rgba", "bc1", "bc3", "bc4" };
+
+int main(int argc, char **argv)
+{
+    int formatIndex = -1;
+    for (int i = 0; argc >= 4 && i < 5; i++)
+        if (std::strcmp(argv[3], FORMAT_NAMES[i]) == 0)
+            formatIndex = i;
+    if (argc < 4 || argc > 5 || formatIndex < 0 ||
+        (argc == 5 && std::strcmp(argv[4], "box") != 0 && std::strcmp(argv[4], "triangle") != 0))
+    {
+        std::cout << "Usage: " << argv[0] << " <input image> <output .tex> <rgb|rgba|bc1|bc3|bc4> [box|triangle]"
+                  << std::endl;
+        return EXIT_FAILURE;
+    }
+    bool compressed = formatIndex >= 2;
+    const BlockFormat BLOCK_FORMATS[3] = { BLOCK_FORMAT_BC1, BLOCK_FORMAT_BC3, BLOCK_FORMAT_BC4 };
+    BlockFormat blockFormat = BLOCK_FORMATS[compressed ? formatIndex - 2 : 0];
+    MipFilter filter = argc == 5 && std::strcmp(argv[4], "triangle") == 0 ? MIP_FILTER_TRIANGLE : MIP_FILTER_BOX;
+
+    // Same orientation as the images the app loads at runtime
+    stbi_set_flip_vertically_on_load(true);
+    // The block formats take what they encode: RGB for BC1, RGBA for BC3 and grey for BC4
+    int stored = !compressed ? 4 : blockFormat == BLOCK_FORMAT_BC1 ? 3 : blockFormat == BLOCK_FORMAT_BC3 ? 4 : 1;
+    int width, height, channels;
+    unsigned char *image = stbi_load(argv[1], &width, &height, &channels, compressed ? stored : 0);
+    if (!image)
+    {
+        std::cout << "Failed to load texture " << argv[1] << std::endl;
+        return EXIT_FAILURE;
+    }
+    size_t count = static_cast<size_t>(width) * height;
+    std::vector<GLubyte> base;
+    if (compressed)
+        base.assign(image, image + count * stored);
+    else
+    {
+        base.resize(count * 4);
+        convertPixels(detectMipSimd(), image, channels, &base[0], count,
+                      formatIndex == 0 ? PIXEL_CONVERT_OPAQUE : PIXEL_CONVERT_NONE);
+    }
+    stbi_image_free(image);
+    GLenum format = stored == 4 ? GL_RGBA : stored == 3 ? GL_RGB : GL_RED;
+    GLenum internalFormat = compressed ? blockFormatGL(blockFormat) : GL_RGBA8;
+
+    // Every level down to 1x1, like glGenerateMipmap. Color images are sRGB, one channel data is linear.
+    std::vector<MipLevel> mips;
+    MipGenerator generator;
+    generator.generate(&base[0], width, height, stored, stored != 1, filter, mips);
+
+    std::vector<CookedTextureLevel> levels;
+    std::vector< std::vector<GLubyte> > pixels;
+    CookedTextureLevel level = { 0, 0, static_cast<uint32_t>(width), static_cast<uint32_t>(height) };
+    levels.push_back(level);
+    pixels.push_back(std::vector<GLubyte>());
+    pixels.back().swap(base);
+    for (size_t i = 0; i < mips.size(); i++)
+    {
+        level.width = mips[i].width;
+        level.height = mips[i].height;
+        levels.push_back(level);
+        pixels.push_back(std::vector<GLubyte>());
+        pixels.back().swap(mips[i].pixels);
+    }
+
+    // Mipmapped from the full image, then every level is compressed on its own
+    size_t uncompressedBytes = 0;
+    if (compressed)
+    {
+        BlockCompressor compressor;
+        for (size_t i = 0; i < levels.size(); i++)
+        {
+            std::vector<GLubyte> blocks;
+            compressor.compress(&pixels[i][0], levels[i].width, levels[i].height, stored, blockFormat, blocks);
+            uncompressedBytes += pixels[i].size();
+            pixels[i].swap(blocks);
+        }
+    }
+
+    if (!writeCookedTexture(argv[2], GL_UNSIGNED_BYTE, format, internalFormat, levels, pixels))
+    {
+        std::cout << "Failed to write " << argv[2] << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout << "Cooked " << argv[1] << ": " << width << "x" << height << ", "
+              << levels.size() << " levels, " << FORMAT_NAMES[formatIndex];
+    if (compressed)
+    {
+        size_t compressedBytes = 0;
+        for (size_t i = 0; i < pixels.size(); i++)
+            compressedBytes += pixels[i].size();
+        std::cout << " (" << compressedBytes / 1024 << " KB from " << uncompressedBytes / 1024 << " KB)";
+    }
+    std::cout << std::endl;
+    return EXIT_SUCCESS;
+}